@@ -4,12 +4,17 @@
 
 #include <ethernet/device.h>
 #include <ethernet/endian.h>
+#include <ip/packet.h>
+#include <tcp/real_socket.h>
 #include <unistd.h>
 #include <net/if.h>
 #include <sys/ioctl.h>
 #include <sys/socket.h>
+#include <cerrno>
+#include <chrono>
 #include <cstring>
 #include <iostream>
+#include <thread>
 
 /**
  * @brief Constructor of `Device`. Initialize pcap session.
@@ -17,11 +22,42 @@
  * @param device The device name to open for sending/receiving frames.
  */
 Device::Device(const char *device, u_char mac[ETHER_ADDR_LEN], int i): 
-    callback(NULL), frame_id(0), fd(-1), ip_addr({0}), id(i)
+    callback(NULL), frame_id(0), fd(-1), mtu(MAX_PAYLOAD), ip_addr({0}), 
+    tx_batch_len(0), tx_pending(false), tx_running(true), id(i)
 {
+    // Read the MTU of the interface. Use the real `socket` and `close`, 
+    // since the wrapped ones would need the transport layer being built.
+    struct ifreq ifr;
+    memset(&ifr, 0, sizeof(ifr));
+    strncpy(ifr.ifr_name, device, IFNAMSIZ - 1);
+    int sock = __real_socket(AF_INET, SOCK_DGRAM, 0);
+    if((sock == -1) || (ioctl(sock, SIOCGIFMTU, &ifr) == -1)){
+        std::cerr << "Get MTU of " << device << " error! Use ";
+        std::cerr << MAX_PAYLOAD << "." << std::endl;
+    }
+    else if(ifr.ifr_mtu >= MIN_MTU){
+        mtu = ifr.ifr_mtu;
+    }
+    if(sock != -1){
+        __real_close(sock);
+    }
+
+    scheduler.setMaxFrameLen(SIZE_ETHERNET + mtu);
+
+    // Slots of the batched send.
+    tx_slot_len = SIZE_ETHERNET + mtu;
+    memset(tx_msgs, 0, sizeof(tx_msgs));
+    for(int j = 0; j < TX_BATCH_SIZE; j++){
+        tx_iovs[j].iov_base = new u_char[tx_slot_len];
+        tx_iovs[j].iov_len = 0;
+        tx_msgs[j].msg_hdr.msg_iov = &tx_iovs[j];
+        tx_msgs[j].msg_hdr.msg_iovlen = 1;
+    }
+    tx_thread = std::thread(&Device::txLoop, this);
+
     // Open handler.
     char errbuf[PCAP_ERRBUF_SIZE] = "";
-    handle = pcap_open_live(device, BUFSIZ, 1, 1000, errbuf);
+    handle = pcap_open_live(device, SNAPLEN, 1, 1000, errbuf);
     if(handle == NULL){
         std::cerr << "Couldn't find default device: " << errbuf << std::endl;
         return;
@@ -49,33 +85,49 @@ Device::Device(const char *device, u_char mac[ETHER_ADDR_LEN], int i):
 }
 
 /**
- * @brief Destructor of `Device`. Close `handle`.
+ * @brief Destructor of `Device`. Stop the transmit thread, close `handle` 
+ * and free the batch slots.
  */
 Device::~Device()
 {
+    tx_mutex.lock();
+    tx_running = false;
+    tx_mutex.unlock();
+    tx_cond.notify_one();
+    tx_thread.join();
     pcap_close(handle);
+    for(int j = 0; j < TX_BATCH_SIZE; j++){
+        delete[] (u_char *)tx_iovs[j].iov_base;
+    }
+    for(auto slot: spare_slots){
+        delete[] slot;
+    }
 }
 
 /**
  * @brief Check whether the length of the frame is valid. 
  * 
- * Follow the rule of Ethernet II, i.e., the length of data is in [46, 1500]. 
+ * Follow the rule of Ethernet II, i.e., the length of data is in [46, MTU], 
+ * where MTU is 1500 unless the interface supports jumbo frames. 
  * If the length is less than 46, pad the packet with 0.
  */
 inline bool
 Device::is_valid_length(int len)
 {
-    return (len <= MAX_PAYLOAD);
+    return (len <= mtu);
 }
 
 /**
-* @brief Encapsulate some data into an Ethernet II frame and send it.
+* @brief Encapsulate some data into an Ethernet II frame and send it. The 
+* frame goes through the egress scheduler in the class given by the TOS of 
+* its IP header. Non-IP frames, i.e., ARP, are control traffic.
 *
 * @param buf Pointer to the payload.
 * @param len Length of the payload.
 * @param ethtype EtherType field value of this frame.
 * @param dest_ip IP address of the destination.
-* @return 0 on success, -1 on error.
+* @return 0 on success, -1 on error. A frame queued counts as success, but 
+* one dropped as its queue is full doesn't.
 * @see addDevice
 */
 int 
@@ -102,15 +154,349 @@ Device::sendFrame(const void* buf, int len,
     memcpy(frame + 2 * ETHER_ADDR_LEN, &correct_ethtype, ETHER_TYPE_LEN);
     memcpy(frame + SIZE_ETHERNET, buf, len);
     memset(frame + SIZE_ETHERNET + len, 0, real_len - len);
-    if(pcap_sendpacket(handle, frame, frame_len) != 0){
-        std::cerr << "Send frame failed!" << std::endl;
+
+    int cls = TrafficClass::CONTROL;
+    if(ethtype == ETHTYPE_IPv4){
+        const IPv4Header *ipv4_header = (const IPv4Header *)buf;
+        cls = EgressScheduler::classify(ipv4_header->service_type);
+    }
+    int rc = 0;
+    bool drainer = true;
+    if(scheduler.bypass()){
+        if(sendRaw(frame, frame_len) != 0){
+            std::cerr << "Send frame failed!" << std::endl;
+            rc = -1;
+        }
         delete[] frame;
+    }
+    else if(!scheduler.enqueue({frame, frame_len, false}, cls, &drainer)){
+        delete[] frame;
+        rc = -1;
+    }
+    if(drainer){
+        drain();
+    }
+    return rc;
+}
+
+/**
+ * @brief Send a frame. If the kernel is out of buffer space, wait for it to 
+ * drain a little and retry instead of dropping the frame at once.
+ * 
+ * @return 0 on success, -1 on error.
+ */
+int 
+Device::sendRaw(const u_char *frame, int len)
+{
+    for(int i = 0; i <= SEND_RETRIES; i++){
+        if(pcap_sendpacket(handle, frame, len) == 0){
+            return 0;
+        }
+        if((errno != ENOBUFS) && (errno != EAGAIN)){
+            break;
+        }
+        std::this_thread::sleep_for(
+            std::chrono::microseconds(SEND_RETRY_INTERVAL)
+        );
+    }
+    return -1;
+}
+
+/**
+ * @brief Check whether the egress queues have room for senders that can 
+ * wait, e.g., TCP.
+ */
+bool 
+Device::isWritable()
+{
+    return scheduler.isWritable();
+}
+
+/**
+ * @brief Get the statistics of the egress queues.
+ * 
+ * @see EgressScheduler::getStats
+ */
+void 
+Device::getTxStats(unsigned long *drops, unsigned long *stops)
+{
+    scheduler.getStats(drops, stops);
+}
+
+/**
+ * @brief Take a slot for the batch, reusing a spare one if possible.
+ */
+u_char *
+Device::takeSlot()
+{
+    u_char *slot = NULL;
+    slot_mutex.lock();
+    if(!spare_slots.empty()){
+        slot = spare_slots.back();
+        spare_slots.pop_back();
+    }
+    slot_mutex.unlock();
+    if(slot == NULL){
+        slot = new u_char[tx_slot_len];
+    }
+    return slot;
+}
+
+/**
+ * @brief Free a frame taken from the queues. A batch slot is kept for 
+ * reuse, unless there are enough spare ones.
+ */
+void 
+Device::freeFrame(const QueuedFrame &queued)
+{
+    if(queued.slot){
+        slot_mutex.lock();
+        if(spare_slots.size() < TX_SPARE_SLOTS){
+            spare_slots.push_back(queued.frame);
+            slot_mutex.unlock();
+            return;
+        }
+        slot_mutex.unlock();
+    }
+    delete[] queued.frame;
+}
+
+/**
+ * @brief Send frames in the queues of the scheduler until they are empty, 
+ * or BUDGET frames are sent. Only called by the drainer.
+ * 
+ * @return true if the queues are empty, in which case the caller is no 
+ * longer the drainer, false if the budget is used up.
+ */
+bool 
+Device::drainQueues(int budget)
+{
+    QueuedFrame queued;
+    for(int i = 0; i < budget; i++){
+        if(!scheduler.dequeue(&queued)){
+            return true;
+        }
+        if(sendRaw(queued.frame, queued.len) != 0){
+            std::cerr << "Send frame failed!" << std::endl;
+        }
+        freeFrame(queued);
+    }
+    return false;
+}
+
+/**
+ * @brief Drain the queues as the sender that the scheduler made the 
+ * drainer. The drainer is often the receiving thread, so a sender only 
+ * sends `TX_DRAIN_BUDGET` frames, and hands the rest to the transmit thread 
+ * rather than send for others for as long as they keep the queues filled.
+ * 
+ * @see Linux `__qdisc_run`, which defers to the transmit softirq likewise.
+ */
+void 
+Device::drain()
+{
+    if(drainQueues(TX_DRAIN_BUDGET)){
+        return;
+    }
+    // Still the drainer, on behalf of the thread.
+    tx_mutex.lock();
+    tx_pending = true;
+    tx_mutex.unlock();
+    tx_cond.notify_one();
+}
+
+/**
+ * @brief Main loop of the transmit thread. It drains the queues whenever a 
+ * sender hands them over, until the device is destroyed.
+ */
+void 
+Device::txLoop()
+{
+    std::unique_lock<std::mutex> lock(tx_mutex);
+    while(true){
+        tx_cond.wait(lock, [this]{ return tx_pending || !tx_running; });
+        if(!tx_running){
+            break;
+        }
+        tx_pending = false;
+        lock.unlock();
+        while(!drainQueues(TX_DRAIN_BUDGET)){
+            // Nobody else drains meanwhile.
+        }
+        lock.lock();
+    }
+}
+
+/**
+ * @brief Send a received IPv4 frame out of this device without copying it. 
+ * Only the Ethernet header is rewritten, in place, and the frame is sent at 
+ * once, before libpcap reuses its buffer. If frames are batched or queued 
+ * before it, it's batched by `queueFrame` instead to keep their order.
+ * 
+ * @param frame Pointer to the whole frame, including the Ethernet header. 
+ * Its payload must already be ready for the next hop.
+ * @param len Length of the frame.
+ * @return 0 on success, -1 on error.
+ */
+int 
+Device::forwardFrame(u_char *frame, int len)
+{
+    if((tx_batch_len != 0) || !scheduler.bypass()){
+        return queueFrame(frame, len);
+    }
+    int rc = 0;
+    if(!is_valid_length(len - SIZE_ETHERNET)){
+        std::cerr << "Data length invalid: " << len - SIZE_ETHERNET;
+        std::cerr << " !" << std::endl;
+        rc = -1;
+    }
+    else if(!check_MAC()){
+        std::cerr << "Forward frame failed: destination MAC unavailable!\n";
+        rc = -1;
+    }
+    else{
+        // `callBack` has turned the EtherType into host byte order.
+        EthernetHeader *eth_header = (EthernetHeader *)frame;
+        memcpy(eth_header->ether_dhost, dst_MAC_addr, ETHER_ADDR_LEN);
+        memcpy(eth_header->ether_shost, mac_addr, ETHER_ADDR_LEN);
+        eth_header->ether_type = change_order((u_short)ETHTYPE_IPv4);
+        if(sendRaw(frame, len) != 0){
+            std::cerr << "Forward frame failed!" << std::endl;
+            rc = -1;
+        }
+    }
+    drain();
+    return rc;
+}
+
+/**
+ * @brief Copy a received IPv4 frame into the batch of this device, rewriting 
+ * its Ethernet header on the way. The batch is sent by `flushFrames`, or as 
+ * soon as it is full.
+ * 
+ * @param frame Pointer to the whole frame, including the Ethernet header. 
+ * Its payload must already be ready for the next hop.
+ * @param len Length of the frame.
+ * @return 0 on success, -1 on error.
+ * 
+ * @note The frame has to be copied because libpcap doesn't keep it valid 
+ * after the next capture, but the copy goes to a slot that is reused rather 
+ * than allocated per frame, even if it waits in the egress queues.
+ */
+int 
+Device::queueFrame(const u_char *frame, int len)
+{
+    if(!is_valid_length(len - SIZE_ETHERNET)){
+        std::cerr << "Data length invalid: " << len - SIZE_ETHERNET;
+        std::cerr << " !" << std::endl;
         return -1;
     }
-    delete[] frame;
+    if(!check_MAC()){
+        std::cerr << "Forward frame failed: destination MAC unavailable!\n";
+        return -1;
+    }
+    u_char *slot = (u_char *)tx_iovs[tx_batch_len].iov_base;
+    EthernetHeader *eth_header = (EthernetHeader *)slot;
+    memcpy(eth_header->ether_dhost, dst_MAC_addr, ETHER_ADDR_LEN);
+    memcpy(eth_header->ether_shost, mac_addr, ETHER_ADDR_LEN);
+    eth_header->ether_type = change_order((u_short)ETHTYPE_IPv4);
+    memcpy(slot + SIZE_ETHERNET, frame + SIZE_ETHERNET, len - SIZE_ETHERNET);
+    tx_iovs[tx_batch_len].iov_len = len;
+    tx_batch_len++;
+    if(tx_batch_len == TX_BATCH_SIZE){
+        return flushFrames();
+    }
     return 0;
 }
 
+/**
+ * @brief Send all frames queued by `queueFrame`. If the egress scheduler is 
+ * idle, they are sent at once. Otherwise their slots are handed to the 
+ * queues of their classes without copying, and replaced in the batch by 
+ * spare ones.
+ * 
+ * @return 0 on success, -1 if any frame was dropped.
+ */
+int 
+Device::flushFrames()
+{
+    if(tx_batch_len == 0){
+        return 0;
+    }
+    if(scheduler.bypass()){
+        int ret = sendBatch();
+        drain();
+        return ret;
+    }
+
+    int ret = 0;
+    bool drainer = false;
+    for(int i = 0; i < tx_batch_len; i++){
+        u_char *frame = (u_char *)tx_iovs[i].iov_base;
+        const IPv4Header *ipv4_header = 
+            (const IPv4Header *)(frame + SIZE_ETHERNET);
+        int cls = EgressScheduler::classify(ipv4_header->service_type);
+        bool first = false;
+        if(scheduler.enqueue({frame, (int)tx_iovs[i].iov_len, true}, cls, 
+                             &first))
+        {
+            tx_iovs[i].iov_base = takeSlot();
+        }
+        else{
+            // The slot stays in the batch.
+            ret = -1;
+        }
+        drainer = drainer || first;
+    }
+    tx_batch_len = 0;
+    if(drainer){
+        drain();
+    }
+    return ret;
+}
+
+/**
+ * @brief Send the batch with as few system calls as possible.
+ * 
+ * @return 0 on success, -1 if any frame was dropped.
+ * 
+ * @note On Linux, the selectable descriptor of a live capture is the packet 
+ * socket `pcap_sendpacket` sends on, so `sendmmsg` can be used on it.
+ */
+int 
+Device::sendBatch()
+{
+    int sent = 0, ret, retries = 0;
+    while(sent < tx_batch_len){
+        if(fd == -1){
+            ret = sendRaw((const u_char *)tx_iovs[sent].iov_base, 
+                          tx_iovs[sent].iov_len) == 0 ? 1 : -1;
+        }
+        else{
+            ret = sendmmsg(fd, tx_msgs + sent, tx_batch_len - sent, 0);
+        }
+        if(ret == -1){
+            if(errno == EINTR){
+                continue;
+            }
+            if(((errno == ENOBUFS) || (errno == EAGAIN)) && 
+               (retries++ < SEND_RETRIES))
+            {
+                std::this_thread::sleep_for(
+                    std::chrono::microseconds(SEND_RETRY_INTERVAL)
+                );
+                continue;
+            }
+            std::cerr << "Send batch failed: " << strerror(errno) << std::endl;
+            break;
+        }
+        sent += ret;
+    }
+    ret = (sent == tx_batch_len) ? 0 : -1;
+    tx_batch_len = 0;
+    return ret;
+}
+
 /**
  * @brief Register a callback function to be called each time an
  * Ethernet II frame was received.
@@ -232,6 +618,16 @@ Device::getFD()
     return fd;
 }
 
+/**
+ * @brief Get MTU of the device, i.e., the maximum length of the payload of a 
+ * frame.
+ */
+int 
+Device::getMTU()
+{
+    return mtu;
+}
+
 /**
  * @brief Actual callback function used in my network stack on receiving a 
  * frame.
@@ -112,6 +112,117 @@ DeviceManager::findDevice(const char* device)
     }
 }
 
+/**
+ * @brief Get receive statistics of a device added by `addDevice`.
+ *
+ * @param id ID of the device.
+ * @param frames Frames received.
+ * @param polls Receive rounds the device was polled in.
+ * @param exhausted Rounds the device used up its receive budget in.
+ * @return true on success, false if no such device was found.
+ * @see EpollServer::waitRead
+ */
+bool 
+DeviceManager::getRxStats(int id, unsigned long *frames, unsigned long *polls,
+                          unsigned long *exhausted)
+{
+    auto it = id2device.find(id);
+    if(it == id2device.end()){
+        return false;
+    }
+    return epoll_server->getRxStats(it->second->getFD(), frames, polls, 
+                                    exhausted);
+}
+
+/**
+ * @brief Get transmit statistics of a device added by `addDevice`.
+ *
+ * @param id ID of the device.
+ * @param drops Array of `TrafficClass::NUM` to store the frames each egress 
+ * queue dropped when full.
+ * @param stops Times the egress queues stopped senders that can wait.
+ * @return true on success, false if no such device was found.
+ * @see EgressScheduler::enqueue
+ */
+bool 
+DeviceManager::getTxStats(int id, unsigned long *drops, unsigned long *stops)
+{
+    auto it = id2device.find(id);
+    if(it == id2device.end()){
+        return false;
+    }
+    it->second->getTxStats(drops, stops);
+    return true;
+}
+
+/**
+ * @brief Set the time the receiving thread busy-polls devices after 
+ * receiving frames, instead of sleeping.
+ *
+ * @param microseconds Time in microseconds. 0 disables busy polling.
+ * @see EpollServer::setBusyPoll
+ */
+void 
+DeviceManager::setBusyPoll(int microseconds)
+{
+    epoll_server->setBusyPoll(microseconds);
+}
+
+/**
+ * @brief Poll device `id` for frames in the calling thread.
+ *
+ * @param id ID of the device. -1 means all devices.
+ * @return Number of frames received.
+ * @see EpollServer::busyPoll
+ */
+int 
+DeviceManager::busyPoll(int id)
+{
+    if(id == -1){
+        return epoll_server->busyPoll(NULL);
+    }
+    auto it = id2device.find(id);
+    if(it != id2device.end()){
+        return epoll_server->busyPoll(it->second);
+    }
+    return 0;
+}
+
+/**
+ * @brief Check whether device `id` has room in its egress queues.
+ * 
+ * @return true if it has, or there is no such device.
+ * @see Device::isWritable
+ */
+bool 
+DeviceManager::isWritable(int id)
+{
+    auto it = id2device.find(id);
+    if(it != id2device.end()){
+        return it->second->isWritable();
+    }
+    return true;
+}
+
+/**
+ * @brief Get MTU of a device added by `addDevice`.
+ *
+ * @param id ID of the device.
+ * @return MTU on success, -1 if no such device was found.
+ */
+int 
+DeviceManager::getMTU(int id)
+{
+    auto it = id2device.find(id);
+    if(it != id2device.end()){
+        return it->second->getMTU();
+    }
+    else{
+        std::cerr << "No device " << id << "!" << std::endl;
+        return -1;
+    }
+}
+
 /**
  * @brief Encapsulate some data into an Ethernet II frame and send it.
  *
@@ -137,6 +248,63 @@ DeviceManager::sendFrame(const void* buf, int len, int ethtype,
     }
 }
 
+/**
+ * @brief Send a received frame out of device `id`, reusing its buffer.
+ *
+ * @param frame Pointer to the frame, including the Ethernet header.
+ * @param len Length of the frame.
+ * @param id ID of the device(returned by `addDevice`) to send on.
+ * @return 0 on success, -1 on error.
+ * @see Device::forwardFrame
+ */
+int 
+DeviceManager::forwardFrame(u_char *frame, int len, int id)
+{
+    auto it = id2device.find(id);
+    if(it != id2device.end()){
+        return it->second->forwardFrame(frame, len);
+    }
+    else{
+        std::cerr << "No device " << id << "!" << std::endl;
+        return -1;
+    }
+}
+
+/**
+ * @brief Queue a received frame for a batched send on device `id`.
+ *
+ * @param frame Pointer to the frame, including the Ethernet header.
+ * @param len Length of the frame.
+ * @param id ID of the device(returned by `addDevice`) to send on.
+ * @return 0 on success, -1 on error.
+ * @see Device::queueFrame
+ */
+int 
+DeviceManager::queueFrame(const u_char *frame, int len, int id)
+{
+    auto it = id2device.find(id);
+    if(it != id2device.end()){
+        return it->second->queueFrame(frame, len);
+    }
+    else{
+        std::cerr << "No device " << id << "!" << std::endl;
+        return -1;
+    }
+}
+
+/**
+ * @brief Send the frames queued on every device, one batch per device.
+ */
+void 
+DeviceManager::flushFrames()
+{
+    for(auto &it: id2device){
+        if(it.second->flushFrames() == -1){
+            std::cerr << "Device " << it.first << " dropped frames!\n";
+        }
+    }
+}
+
 /**
  * @brief Encapsulate some data into an Ethernet II frame and send it.
  *
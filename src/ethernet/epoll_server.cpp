@@ -17,7 +17,8 @@
  * @see epoll_create
  */
 EpollServer::EpollServer(NetworkLayer *net, TransportLayer *trans): 
-    events(), network_layer(net), transport_layer(trans)
+    events(), busy_poll(BUSY_POLL_TIME), spin_time(0), sleep_time(0), 
+    network_layer(net), transport_layer(trans)
 {
     if((epfd = epoll_create(1)) == -1){
         std::cerr << "Epoll creation failed!" << std::endl;
@@ -62,89 +63,267 @@ EpollServer::addRead(int fd, Device *device)
         std::cerr << "FD " << fd << " already exists!" << std::endl;
     }else{
         fd2device[fd] = device;
+        fd2stats[fd];
     }
     return 0;
 }
 
+/**
+ * @brief Pass a frame captured up through the layers.
+ */
+void 
+EpollServer::handleFrame(Device *device, struct pcap_pkthdr *header, 
+                         const u_char *data)
+{
+    const u_char *packet;
+    int header_len;
+    if(header->caplen != header->len){
+        // Drop frames truncated by the snapshot length.
+        return;
+    }
+
+    unsigned int rest_len = header->caplen;
+    unsigned int total_len = rest_len;
+    unsigned int offset = 0;
+    // Link layer
+    rest_len = device->callBack(data, rest_len);
+    if(rest_len == 0){
+        return;
+    }
+    else if(rest_len == -1){
+        return;
+    }
+    // Network layer
+    offset = total_len - rest_len;
+    if(!network_layer){
+        return;
+    }
+    rest_len = network_layer->callBack(data + offset, rest_len, device->id, 
+                                       &header_len, &packet);
+    if(rest_len == 0){
+        return;
+    }
+    else if(rest_len == -1){
+        return;
+    }
+    // Transport layer
+    IPv4Header *ipv4_header = (IPv4Header *)packet;
+    if(!transport_layer){
+        return;
+    }
+    if(ipv4_header->protocol == IPv4_PROTOCOL_UDP){
+        transport_layer->udpCallBack(packet + header_len, rest_len, 
+                                     ipv4_header->src_addr, 
+                                     ipv4_header->dst_addr);
+    }
+    else{
+        transport_layer->callBack(packet + header_len, rest_len, 
+                                  ipv4_header->src_addr, 
+                                  ipv4_header->dst_addr);
+    }
+}
+
+/**
+ * @brief Receive at most BUDGET frames from DEVICE.
+ * 
+ * @return Number of frames received. BUDGET means there may be more.
+ */
+int 
+EpollServer::poll(Device *device, int budget)
+{
+    struct pcap_pkthdr *header;
+    const u_char *data;
+    int received = 0;
+    RxStats &stats = fd2stats[device->getFD()];
+    // Forwarded packets are sent in place unless the device is busy, i.e., 
+    // it gave more than one frame last time.
+    if(network_layer){
+        network_layer->setBatching(stats.last > 1);
+    }
+    while(received < budget){
+        int ret = device->capNextEx(&header, &data);
+        if(ret == 0){
+            // No packets are currently available.
+            break;
+        }
+        else if(ret == -1){
+            // Error
+            break;
+        }
+        received++;
+        handleFrame(device, header, data);
+    }
+    stats.frames += received;
+    stats.last = received;
+
+    // Send packets forwarded from this batch, and ACKs it calls for.
+    if(network_layer && (received != 0)){
+        network_layer->flushForward();
+    }
+    if(transport_layer && (received != 0)){
+        transport_layer->flushAcks();
+    }
+    return received;
+}
+
+/**
+ * @brief Add DEVICE to the current round, unless it's left with frames by 
+ * the last round. Those are added to the tail later.
+ */
+void 
+EpollServer::schedule(Device *device)
+{
+    for(Device *carried: pending){
+        if(carried == device){
+            return;
+        }
+    }
+    ready.push_back(device);
+}
+
 /**
  * @brief Waits for events on the epoll(7) instance referred to by the file 
  * descriptor `epfd`. The buffer pointed to by events is used to return 
  * information from the ready list about file descriptors in the interest list 
  * that have some events available. Up to MAX_EVENTS are returned.
  * 
- * @return 0 on success, -1 on error.
+ * Then runs a round: each ready device receives at most `RX_BUDGET` frames.
+ * Devices left with frames are polled again at the tail of the next round, 
+ * which doesn't wait for events.
  * 
- * @note 
+ * While busy-polling, epoll is skipped and every device is ready.
+ * 
+ * @return 0 on success, -1 on error.
  */
 int 
 EpollServer::waitRead()
 {
-    int n_events = epoll_wait(epfd, events, MAX_EVENTS, TIMEOUT);
-    if(n_events == -1){
-        std::cerr << "Epoll wait error!" << std::endl;
-        return -1;
+    auto start = std::chrono::steady_clock::now();
+    bool spinning = start < spin_deadline;
+    ready.clear();
+    if(spinning){
+        for(auto &it: fd2device){
+            schedule(it.second);
+        }
     }
-
-    for(int i = 0; i < n_events; i++){
-        auto it = fd2device.find(events[i].data.fd);
-        if(it == fd2device.end()){
-            std::cerr << "File descriptor not found!" << std::endl;
+    else{
+        int timeout = pending.empty() ? TIMEOUT : 0;
+        int n_events = epoll_wait(epfd, events, MAX_EVENTS, timeout);
+        if(n_events == -1){
+            std::cerr << "Epoll wait error!" << std::endl;
+            return -1;
+        }
+        if(timeout != 0){
+            sleep_time += std::chrono::duration_cast<
+                std::chrono::microseconds
+            >(std::chrono::steady_clock::now() - start).count();
         }
 
-        // Handles a capture event.
-        struct pcap_pkthdr *header;
-        const u_char *data;
-        int ret, header_len;
-        while(true){
-            ret = it->second->capNextEx(&header, &data);
-            if(ret == 0){
-                // No packets are currently available.
-                break;
-            }
-            else if(ret == -1){
-                // Error
-                break;
-            }
-            else if(header->caplen != header->len){
-                // Drop fragmented packets.
-                continue;
-            }
-            
-            unsigned int rest_len = header->caplen;
-            unsigned int total_len = rest_len;
-            unsigned int offset = 0;
-            // Link layer
-            rest_len = it->second->callBack(data, rest_len);
-            if(rest_len == 0){
+        for(int i = 0; i < n_events; i++){
+            auto it = fd2device.find(events[i].data.fd);
+            if(it == fd2device.end()){
+                std::cerr << "File descriptor not found!" << std::endl;
                 continue;
             }
-            else if(rest_len == -1){
-                continue;
-            }
-            // Network layer
-            offset = total_len - rest_len;
-            if(!network_layer){
-                continue;
-            }
-            rest_len = network_layer->callBack(data + offset, rest_len, 
-                                               it->second->id, &header_len);
-            if(rest_len == 0){
-                continue;
-            }
-            else if(rest_len == -1){
-                continue;
-            }
-            // Transport layer
-            IPv4Header *ipv4_header = (IPv4Header *)(data + offset);
-            offset += header_len;
-            if(!transport_layer){
-                continue;
-            }
-            transport_layer->callBack(data + offset, rest_len, 
-                                      ipv4_header->src_addr, 
-                                      ipv4_header->dst_addr);
+            schedule(it->second);
+        }
+    }
+    ready.insert(ready.end(), pending.begin(), pending.end());
+    pending.clear();
+
+    int total = 0;
+    rx_mutex.lock();
+    for(Device *device: ready){
+        int received = poll(device, RX_BUDGET);
+        RxStats &stats = fd2stats[device->getFD()];
+        stats.polls++;
+        if(received == RX_BUDGET){
+            stats.exhausted++;
+            pending.push_back(device);
         }
+        total += received;
+    }
+    rx_mutex.unlock();
 
+    auto end = std::chrono::steady_clock::now();
+    if(total != 0){
+        spin_deadline = end + std::chrono::microseconds(busy_poll);
+    }
+    else if(spinning){
+        spin_time += std::chrono::duration_cast<std::chrono::microseconds>(
+            end - start
+        ).count();
     }
     return 0;
-}
\ No newline at end of file
+}
+
+/**
+ * @brief Get receive statistics of the device read from FD.
+ * 
+ * @return true on success, false if FD isn't read by the server.
+ * @see RxStats
+ */
+bool 
+EpollServer::getRxStats(int fd, unsigned long *frames, unsigned long *polls,
+                        unsigned long *exhausted)
+{
+    auto it = fd2stats.find(fd);
+    if(it == fd2stats.end()){
+        return false;
+    }
+    *frames = it->second.frames;
+    *polls = it->second.polls;
+    *exhausted = it->second.exhausted;
+    return true;
+}
+
+/**
+ * @brief Set the time to busy-poll devices after receiving frames.
+ * 
+ * @param microseconds Time in microseconds. 0 disables busy polling.
+ */
+void 
+EpollServer::setBusyPoll(int microseconds)
+{
+    busy_poll = microseconds < 0 ? 0 : microseconds;
+}
+
+/**
+ * @brief Get the time spent spinning and sleeping. Their ratio is the CPU 
+ * traded for latency: the receiving thread spins for `spin_microseconds` 
+ * without receiving frames, and blocks for `sleep_microseconds`.
+ */
+void 
+EpollServer::getPollStats(unsigned long *spin_microseconds, 
+                          unsigned long *sleep_microseconds)
+{
+    *spin_microseconds = spin_time;
+    *sleep_microseconds = sleep_time;
+}
+
+/**
+ * @brief Poll DEVICE once in the calling thread, instead of waiting for the 
+ * receiving thread to do so. Nothing is done if a round is running in 
+ * another thread, which will receive the frames anyway.
+ * 
+ * @param device Device to poll. NULL means all devices.
+ * @return Number of frames received.
+ */
+int 
+EpollServer::busyPoll(Device *device)
+{
+    if(!rx_mutex.try_lock()){
+        return 0;
+    }
+    int received = 0;
+    if(device != NULL){
+        received = poll(device, RX_BUDGET);
+    }
+    else{
+        for(auto &it: fd2device){
+            received += poll(it.second, RX_BUDGET);
+        }
+    }
+    rx_mutex.unlock();
+    return received;
+}
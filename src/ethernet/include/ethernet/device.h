@@ -6,9 +6,23 @@
 #pragma once
 
 #include "frame.h"
+#include "scheduler.h"
 #include <pcap.h>
+#include <sys/socket.h>
+#include <condition_variable>
 #include <map>
 #include <mutex>
+#include <thread>
+#include <vector>
+
+/* Snapshot length of captures. Large enough that no frame is truncated. */
+#define SNAPLEN 65535
+/* Maximum number of frames sent by one batched send */
+#define TX_BATCH_SIZE 32
+/* Maximum number of spare batch slots kept for reuse */
+#define TX_SPARE_SLOTS 64
+/* Maximum number of frames a sender sends from the egress queues at once */
+#define TX_DRAIN_BUDGET 64
 
 /**
  * @brief Process a frame upon receiving it. 
@@ -41,13 +55,39 @@ private:
     frameReceiveCallback callback;
     int frame_id;
     int fd;
+    int mtu;
     struct in_addr ip_addr;
     u_char mac_addr[ETHER_ADDR_LEN];
     std::mutex arp_mutex;
     u_char dst_MAC_addr[ETHER_ADDR_LEN];
+    // Frames waiting for a batched send. Only used on the receive path, 
+    // under `EpollServer::rx_mutex`.
+    int tx_slot_len;
+    struct iovec tx_iovs[TX_BATCH_SIZE];
+    struct mmsghdr tx_msgs[TX_BATCH_SIZE];
+    int tx_batch_len;
+    // Slots handed to the egress queues come back here once they're sent, 
+    // by whichever thread drains the queues.
+    std::vector<u_char *> spare_slots;
+    std::mutex slot_mutex;
+    EgressScheduler scheduler;
+    // Transmit thread, which takes over draining from a sender that used up 
+    // its budget
+    std::thread tx_thread;
+    std::mutex tx_mutex;
+    std::condition_variable tx_cond;
+    bool tx_pending;                // Draining is handed to the thread
+    bool tx_running;
     inline bool is_valid_length(int len);
     inline bool check_MAC(u_char MAC[ETHER_ADDR_LEN]);
     inline bool check_MAC();
+    int sendRaw(const u_char *frame, int len);
+    u_char *takeSlot();
+    void freeFrame(const QueuedFrame &queued);
+    bool drainQueues(int budget);
+    void drain();
+    void txLoop();
+    int sendBatch();
     bool handle_ARP(const u_char *buf);
     bool reply_ARP(
         const u_char sender_MAC[ETHER_ADDR_LEN], 
@@ -61,11 +101,17 @@ public:
     ~Device();
     int sendFrame(const void* buf, int len, 
                   int ethtype, const struct in_addr dest_ip);
+    int forwardFrame(u_char *frame, int len);
+    int queueFrame(const u_char *frame, int len);
+    int flushFrames();
     void setFrameReceiveCallback(frameReceiveCallback callback);
     int capNext();
     int capLoop(int cnt);
     int capNextEx(struct pcap_pkthdr **header, const u_char **data);
     int getFD();
+    int getMTU();
+    bool isWritable();
+    void getTxStats(unsigned long *drops, unsigned long *stops);
     int callBack(const u_char *buf, int len);
     void setIP(struct in_addr addr);
     bool request_ARP();
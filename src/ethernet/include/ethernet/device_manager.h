@@ -31,8 +31,18 @@ public:
     ~DeviceManager();
     int addDevice(const char* device);
     int findDevice(const char* device);
+    int getMTU(int id);
+    bool getRxStats(int id, unsigned long *frames, unsigned long *polls, 
+                    unsigned long *exhausted);
+    bool getTxStats(int id, unsigned long *drops, unsigned long *stops);
+    void setBusyPoll(int microseconds);
+    int busyPoll(int id);
+    bool isWritable(int id);
     int sendFrame(const void* buf, int len, int ethtype, 
                   struct in_addr dest_ip, int id);
+    int forwardFrame(u_char *frame, int len, int id);
+    int queueFrame(const u_char *frame, int len, int id);
+    void flushFrames();
     void sendFrameAll(const void* buf, int len, int ethtype, 
                      struct in_addr dest_ip);
     int setFrameReceiveCallback(frameReceiveCallback callback, int id);
@@ -4,19 +4,60 @@
  * @brief Defines a server class `EpollServer` using epoll for receiving 
  * frames in a non-blocking way. I finally chose epoll because it's more 
  * efficient than other motheds like select or poll.
+ *
+ * Like NAPI, each ready device is polled for at most `RX_BUDGET` frames per
+ * round, so a flooded device can't starve the others. A device that used up
+ * its budget goes to the tail of the next round, which starts without
+ * waiting.
+ *
+ * After a round receives frames, the server busy-polls all devices for
+ * `busy_poll` microseconds instead of sleeping in `epoll_wait`, so frames
+ * arriving under load are received without a wakeup. Once no frame arrives
+ * in that time, it goes back to sleeping, and an idle server spins no CPU.
+ *
+ * Application threads waiting for data may also poll devices with
+ * `busyPoll`, running the receive path themselves. Rounds are serialized by
+ * `rx_mutex`, so the receive path still runs in one thread at a time.
  */
 
 #pragma once
 
 #include "device.h"
 #include <sys/epoll.h>
+#include <atomic>
+#include <chrono>
 #include <map>
+#include <mutex>
+#include <vector>
 
 class NetworkLayer;
 class TransportLayer;
 
 #define MAX_EVENTS 256
 #define TIMEOUT 100
+/* Maximum number of frames received from a device per round */
+#define RX_BUDGET 64
+/* Default time(in microseconds) to busy-poll after receiving frames */
+#define BUSY_POLL_TIME 50
+
+/**
+ * @brief Receive statistics of a device.
+ *
+ * @param frames Frames received.
+ * @param polls Rounds the device was polled in.
+ * @param exhausted Rounds the device used up its budget in, i.e., it had
+ * more frames than it was allowed to receive.
+ * @param last Frames received by the last poll. Only used with `rx_mutex`.
+ */
+struct RxStats
+{
+    std::atomic<unsigned long> frames;
+    std::atomic<unsigned long> polls;
+    std::atomic<unsigned long> exhausted;
+    int last;
+
+    RxStats(): frames(0), polls(0), exhausted(0), last(0) {}
+};
 
 class EpollServer
 {
@@ -24,11 +65,32 @@ private:
     int epfd;
     struct epoll_event events[MAX_EVENTS];
     std::map<int, Device *> fd2device;
+    std::map<int, RxStats> fd2stats;
+    std::mutex rx_mutex;
+    // Devices in the current round, and those left with frames by it
+    std::vector<Device *> ready;
+    std::vector<Device *> pending;
+    std::atomic<int> busy_poll;
+    std::chrono::steady_clock::time_point spin_deadline;
+    // Time(in microseconds) spent spinning without receiving frames, and 
+    // blocked in `epoll_wait`.
+    std::atomic<unsigned long> spin_time;
+    std::atomic<unsigned long> sleep_time;
     NetworkLayer *network_layer;
     TransportLayer *transport_layer;
+    void schedule(Device *device);
+    void handleFrame(Device *device, struct pcap_pkthdr *header, 
+                     const u_char *data);
+    int poll(Device *device, int budget);
 public:
     EpollServer(NetworkLayer *net, TransportLayer *trans);
     ~EpollServer();
     int addRead(int fd, Device *device);
     int waitRead();
+    bool getRxStats(int fd, unsigned long *frames, unsigned long *polls, 
+                    unsigned long *exhausted);
+    void setBusyPoll(int microseconds);
+    int busyPoll(Device *device);
+    void getPollStats(unsigned long *spin_microseconds, 
+                      unsigned long *sleep_microseconds);
 };
@@ -38,7 +38,7 @@
 
 /* Min length of payload */
 #define MIN_PAYLOAD 46
-/* Max length of payload */
+/* Max length of payload, unless the device has a larger MTU */
 #define MAX_PAYLOAD 1500
 
 /* Ethernet header */
@@ -0,0 +1,84 @@
+/**
+ * @file scheduler.h
+ * @brief Egress scheduler of a device. Frames are put into queues by the
+ * DSCP of their IP header. Control traffic has strict priority, and the
+ * data classes share the rest of the link by deficit round robin.
+ *
+ * Like a qdisc, the scheduler has no thread of its own: the sender finding
+ * it idle sends directly, and otherwise queues its frame and drains the
+ * queues unless another sender is already draining them. A sender drains a
+ * bounded number of frames, and the device's transmit thread the rest.
+ *
+ * Bytes queued are limited. Once they reach the limit, the device stops
+ * accepting data from senders that can wait, e.g., TCP, until draining
+ * brings them down to half of it.
+ */
+
+#pragma once
+
+#include <sys/types.h>
+#include <deque>
+#include <mutex>
+
+/* Maximum number of frames queued in a class */
+#define SCHED_QUEUE_LEN 1024
+/* Byte limit of the queues in terms of maximum frame length */
+#define SCHED_BYTE_LIMIT 64
+/* Times to retry a frame the kernel has no buffer for */
+#define SEND_RETRIES 8
+/* Time(in microseconds) to wait before retrying */
+#define SEND_RETRY_INTERVAL 100
+/* Weights of the data classes. Each round, a class may send its weight 
+ * times the maximum frame length. */
+#define WEIGHT_INTERACTIVE 4
+#define WEIGHT_BEST_EFFORT 2
+#define WEIGHT_BULK        1
+
+namespace TrafficClass {
+    enum TrafficClass {
+        CONTROL,     // Routing messages and ARP. Strict priority.
+        INTERACTIVE, // EF, AF4x, CS4, CS5
+        BEST_EFFORT, // Everything else
+        BULK,        // CS1(lower effort)
+        NUM,
+    };
+}
+
+/**
+ * @brief A frame waiting in a queue. It owns the buffer, allocated by new[].
+ */
+struct QueuedFrame
+{
+    u_char *frame;
+    int len;
+    bool slot; // A batch slot of the device, reused after it's sent
+};
+
+class EgressScheduler
+{
+private:
+    std::mutex mutex;
+    std::deque<QueuedFrame> queues[TrafficClass::NUM];
+    int quantum[TrafficClass::NUM]; // Bytes per round of the data classes
+    int deficit[TrafficClass::NUM];
+    int current;                    // Data class in its round
+    bool in_round;
+    int backlog;                    // Frames in all queues
+    bool busy;                      // Whether a sender is draining queues
+    int bytes;                      // Bytes in all queues
+    int byte_limit;
+    bool stopped;                   // Whether bytes have reached the limit
+    unsigned long drops[TrafficClass::NUM]; // Frames dropped, queue full
+    unsigned long stops;            // Times it has been stopped
+    void release(int len);
+public:
+    EgressScheduler();
+    ~EgressScheduler();
+    void setMaxFrameLen(int len);
+    static int classify(u_char tos);
+    bool bypass();
+    bool enqueue(const QueuedFrame &queued, int cls, bool *drainer);
+    bool dequeue(QueuedFrame *queued);
+    bool isWritable();
+    void getStats(unsigned long *dropped, unsigned long *stopped_cnt);
+};
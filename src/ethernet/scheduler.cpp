@@ -0,0 +1,236 @@
+/**
+ * @file scheduler.cpp
+ */
+
+#include <ethernet/frame.h>
+#include <ethernet/scheduler.h>
+#include <iostream>
+
+EgressScheduler::EgressScheduler(): 
+    current(TrafficClass::INTERACTIVE), in_round(false), backlog(0), 
+    busy(false), bytes(0), stopped(false), stops(0)
+{
+    for(int i = 0; i < TrafficClass::NUM; i++){
+        deficit[i] = 0;
+        drops[i] = 0;
+    }
+    setMaxFrameLen(SIZE_ETHERNET + MAX_PAYLOAD);
+}
+
+/**
+ * @brief Free frames still in queues.
+ */
+EgressScheduler::~EgressScheduler()
+{
+    for(int i = 0; i < TrafficClass::NUM; i++){
+        for(auto &queued: queues[i]){
+            delete[] queued.frame;
+        }
+    }
+}
+
+/**
+ * @brief Set quanta of the data classes by the maximum frame length of the 
+ * device, so that any frame can be sent in one round. The byte limit scales 
+ * with it too.
+ */
+void 
+EgressScheduler::setMaxFrameLen(int len)
+{
+    byte_limit = SCHED_BYTE_LIMIT * len;
+    quantum[TrafficClass::CONTROL] = 0;
+    quantum[TrafficClass::INTERACTIVE] = WEIGHT_INTERACTIVE * len;
+    quantum[TrafficClass::BEST_EFFORT] = WEIGHT_BEST_EFFORT * len;
+    quantum[TrafficClass::BULK] = WEIGHT_BULK * len;
+}
+
+/**
+ * @brief Map the Type of Service byte of an IP header to a traffic class.
+ * 
+ * @see RFC2474 & RFC4594 & RFC8622
+ */
+int 
+EgressScheduler::classify(u_char tos)
+{
+    u_char dscp = tos >> 2;
+    switch (dscp)
+    {
+    case 48: // CS6: network control
+    case 56: // CS7
+        return TrafficClass::CONTROL;
+
+    case 46: // EF
+    case 40: // CS5
+    case 32: // CS4
+    case 34: // AF41
+    case 36: // AF42
+    case 38: // AF43
+        return TrafficClass::INTERACTIVE;
+
+    case 8:  // CS1
+    case 1:  // LE
+        return TrafficClass::BULK;
+
+    default:
+        return TrafficClass::BEST_EFFORT;
+    }
+}
+
+/**
+ * @brief Check whether a frame can skip the queues, i.e., nothing is queued 
+ * and no sender is draining. If so, the caller becomes the drainer and must 
+ * call `dequeue` until it returns false after sending its frame.
+ */
+bool 
+EgressScheduler::bypass()
+{
+    bool ret = false;
+    mutex.lock();
+    if(!busy && (backlog == 0)){
+        busy = true;
+        ret = true;
+    }
+    mutex.unlock();
+    return ret;
+}
+
+/**
+ * @brief Put a frame into the queue of its class. The frame is dropped if 
+ * the queue is full.
+ * 
+ * @param queued The frame allocated by new[]. The scheduler owns it once 
+ * it's queued. A frame dropped is left to the caller to free.
+ * @param cls Traffic class of the frame.
+ * @param drainer Set to true if no sender is draining queues, in which case 
+ * the caller becomes the drainer and must call `dequeue` until it returns 
+ * false, and to false otherwise. That holds even if the frame is dropped.
+ * @return true if the frame is queued, false if it's dropped.
+ */
+bool 
+EgressScheduler::enqueue(const QueuedFrame &queued, int cls, bool *drainer)
+{
+    bool ret = true;
+    mutex.lock();
+    if(queues[cls].size() >= SCHED_QUEUE_LEN){
+        drops[cls]++;
+        ret = false;
+    }
+    else{
+        queues[cls].push_back(queued);
+        backlog++;
+        bytes += queued.len;
+        if(!stopped && (bytes >= byte_limit)){
+            stopped = true;
+            stops++;
+        }
+    }
+    *drainer = !busy;
+    busy = true;
+    mutex.unlock();
+    return ret;
+}
+
+/**
+ * @brief Take the next frame to send. Control frames go first. Data classes 
+ * are served by deficit round robin.
+ * 
+ * @param queued Set to the frame. The caller owns it afterwards.
+ * @return false if all queues are empty, in which case the caller is no 
+ * longer the drainer.
+ * 
+ * @see Shreedhar, M., & Varghese, G. (1996). Efficient fair queuing using 
+ * deficit round-robin.
+ */
+bool 
+EgressScheduler::dequeue(QueuedFrame *queued)
+{
+    mutex.lock();
+    if(backlog == 0){
+        busy = false;
+        mutex.unlock();
+        return false;
+    }
+    backlog--;
+    std::deque<QueuedFrame> &control = queues[TrafficClass::CONTROL];
+    if(!control.empty()){
+        *queued = control.front();
+        control.pop_front();
+        release(queued->len);
+        mutex.unlock();
+        return true;
+    }
+
+    // Some data class has frames, so this ends within a round.
+    while(true){
+        std::deque<QueuedFrame> &queue = queues[current];
+        if(!queue.empty()){
+            if(!in_round){
+                deficit[current] += quantum[current];
+                in_round = true;
+            }
+            if(queue.front().len <= deficit[current]){
+                *queued = queue.front();
+                queue.pop_front();
+                deficit[current] -= queued->len;
+                release(queued->len);
+                if(queue.empty()){
+                    deficit[current] = 0;
+                    in_round = false;
+                    current = (current % (TrafficClass::NUM - 1)) + 1;
+                }
+                mutex.unlock();
+                return true;
+            }
+        }
+        else{
+            deficit[current] = 0;
+        }
+        in_round = false;
+        current = (current % (TrafficClass::NUM - 1)) + 1;
+    }
+}
+
+/**
+ * @brief Account for a frame leaving the queues, and start accepting data 
+ * from senders that can wait once bytes fall to half of the limit.
+ * 
+ * @note The caller must hold `mutex`.
+ */
+void 
+EgressScheduler::release(int len)
+{
+    bytes -= len;
+    if(stopped && (bytes <= byte_limit / 2)){
+        stopped = false;
+    }
+}
+
+/**
+ * @brief Check whether the queues have room for senders that can wait.
+ */
+bool 
+EgressScheduler::isWritable()
+{
+    mutex.lock();
+    bool ret = !stopped;
+    mutex.unlock();
+    return ret;
+}
+
+/**
+ * @brief Get the statistics of the queues.
+ * 
+ * @param dropped Array of `TrafficClass::NUM` to store the frames dropped 
+ * in each class, as its queue was full.
+ * @param stopped_cnt Times the queues reached the byte limit.
+ */
+void 
+EgressScheduler::getStats(unsigned long *dropped, unsigned long *stopped_cnt)
+{
+    mutex.lock();
+    for(int i = 0; i < TrafficClass::NUM; i++){
+        dropped[i] = drops[i];
+    }
+    *stopped_cnt = stops;
+    mutex.unlock();
+}
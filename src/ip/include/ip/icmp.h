@@ -0,0 +1,60 @@
+/**
+ * @file icmp.h
+ *
+ * @brief Utilities for constructing ICMP messages.
+ *
+ *  0                   1                   2                   3
+ *  0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
+ * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ * |     Type      |     Code      |          Checksum             |
+ * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ * |                     Depends on the type                       |
+ * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ * |      Internet Header + 64 bits of Original Data Datagram      |
+ * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ *
+ *                     Format of ICMP error messages
+ */
+
+#pragma once
+
+#include <sys/types.h>
+
+/* ICMP headers are 8 bytes */
+#define SIZE_ICMP 8
+/* Bytes of the original datagram's data quoted by error messages */
+#define ICMP_QUOTED_DATA 8
+
+/* Codes of Destination Unreachable */
+#define ICMP_CODE_FRAG_NEEDED 4
+/* Codes of Time Exceeded */
+#define ICMP_CODE_TTL_EXCEEDED 0
+
+namespace ICMPType {
+    enum ICMPType {
+        ECHO_REPLY       = 0,
+        DEST_UNREACHABLE = 3,
+        ECHO_REQUEST     = 8,
+        TIME_EXCEEDED    = 11,
+    };
+}
+
+/* ICMP header */
+struct ICMPHeader
+{
+    u_char type;
+    u_char code;
+    u_short checksum;
+    u_short unused;
+    u_short next_hop_mtu; // Fragmentation needed. See RFC1191.
+};
+
+/* Header of echo requests and replies */
+struct ICMPEcho
+{
+    u_char type;
+    u_char code;
+    u_short checksum;
+    u_short id;
+    u_short seq;
+};
@@ -6,11 +6,18 @@
 
 #pragma once
 
+#include "probe.h"
+#include "reassembly.h"
 #include "routing_table.h"
 #include <netinet/ip.h>
+#include <atomic>
 #include <chrono>
 #include <mutex>
 #include <thread>
+#include <unordered_map>
+
+/* Time(in milliseconds) before a reduced path MTU is forgotten */
+#define PMTU_TIMEOUT 600000
 
 /**
  * @brief Process an IP packet upon receiving it.
@@ -35,6 +42,17 @@ private:
     DeviceManager device_manager;
     IPPacketReceiveCallback callback;
     RoutingTable routing_table;
+    Reassembler reassembler;
+    std::atomic<u_short> next_id; // Identification of the next packet
+    // Whether forwarded packets are batched, or sent in place at once. Set 
+    // for each receive round, under `EpollServer::rx_mutex`.
+    bool batching;
+    // Path MTUs learned from ICMP "fragmentation needed" messages, indexed 
+    // by destination, with the time they expire.
+    std::unordered_map<unsigned int, 
+        std::pair<int, std::chrono::steady_clock::time_point>> pmtu_cache;
+    std::mutex pmtu_mutex;
+    Prober prober;
     std::thread timer_thread;
     std::mutex timer_mutex;
     bool timer_running;
@@ -43,17 +61,36 @@ private:
     void stopTimer();
     bool handleHello(const u_char *buf, int len, int device_id);
     bool handleLinkState(const u_char *buf, int len, int device_id);
+    int forwardPacket(u_char *buf, int len, int in_device_id, 
+                      int device_id);
+    int sendFragments(const u_char *packet, int mtu, int device_id);
+    int sendICMPError(const u_char *buf, int type, int code, int mtu, 
+                      int device_id);
+    bool handleICMP(u_char *buf, int header_len, int len, bool in_frame);
+    bool handleEcho(u_char *buf, int header_len, int len, bool in_frame);
+    int clampPathMTU(const struct in_addr dest, int mtu);
 public:
     NetworkLayer(TransportLayer *trans = NULL);
     ~NetworkLayer();
     int sendIPPacket(const struct in_addr src, const struct in_addr dest,
-                     int proto, const void* buf, int len);
+                     int proto, const void* buf, int len, 
+                     int ttl = DEFAULT_TTL, int tos = DEFAULT_TOS);
     int setIPPacketReceiveCallback(IPPacketReceiveCallback callback);
     int setRoutingTable(const struct in_addr dest, const struct in_addr mask,
                         const void* nextHopMAC, const char* device);
-    int callBack(const u_char *buf, int len, int device_id, int *header_len);
+    int callBack(const u_char *buf, int len, int device_id, int *header_len,
+                 const u_char **packet);
+    void setBatching(bool batch);
+    void flushForward();
     bool sendHelloPacket();
     bool sendLinkStatePacket();
     struct in_addr getIP();
+    struct in_addr getIP(int device_id);
+    int getMTU(const struct in_addr dest);
+    int getPathMTU(const struct in_addr dest);
+    bool isWritable(const struct in_addr dest);
+    int busyPoll(const struct in_addr src);
     bool findIP(const struct in_addr addr);
+    int probe(const struct in_addr dest, int max_hops, int count, 
+              std::vector<HopStats> &hops);
 };
@@ -31,6 +31,8 @@
 #define IPv4_ADDR_LEN	4
 /* IPv4 headers excluding options are 20 bytes(true when sending packets) */
 #define SIZE_IPv4  20
+/* Every host must accept 68-byte datagrams without fragmentation */
+#define MIN_MTU    68
 
 /* Get some fields shorter than a byte. */
 /* Version(just check its correctness) */
@@ -43,6 +45,8 @@
 #define DEFAULT_IHL 5
 /* Type of Service */
 #define DEFAULT_TOS 0
+/* DSCP CS6(network control) for routing messages */
+#define CONTROL_TOS 0xc0
 /* Identification */
 #define DEFAULT_ID  0
 /* Reserved bit, flags and Fragment Offset */
@@ -53,8 +57,12 @@
 /* Time to Live */
 #define DEFAULT_TTL 255
 /* Protocol */
+/* ICMP */
+#define IPv4_PROTOCOL_ICMP     1
 /* TCP */
 #define IPv4_PROTOCOL_TCP      6
+/* UDP */
+#define IPv4_PROTOCOL_UDP      17
 /* HELLO/ECHO */
 #define IPv4_PROTOCOL_TESTING1 253
 /* Routing message */
@@ -86,6 +94,26 @@ struct IPv4Header
  */
 u_short calculate_checksum(const u_short *header, int len);
 
+/**
+ * @brief Calculate checksum of a whole message, e.g., a TCP segment with its 
+ * pseudo header or an ICMP message.
+ * @param segment Message address.
+ * @param len Length of the message in terms of byte.
+ * @return checksum
+ */
+u_short calculate_checksum(const u_char *segment, int len);
+
+/**
+ * @brief Incrementally update a checksum after one 16-bit word of the 
+ * checksummed data changes, without summing the whole header again.
+ * @param checksum Old checksum as it is stored in the header.
+ * @param old_word Old value of the changed word as it is stored.
+ * @param new_word New value of the changed word as it is stored.
+ * @return New checksum, in the same byte order as the arguments.
+ * @see RFC1624 (Eqn. 3)
+ */
+u_short update_checksum(u_short checksum, u_short old_word, u_short new_word);
+
 /* HELLO packets are always 8 bytes */
 #define SIZE_HELLO_PACKET 8
 
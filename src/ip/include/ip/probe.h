@@ -0,0 +1,85 @@
+/**
+ * @file probe.h
+ * @brief Latency probing with ICMP echo requests. Probes with increasing TTL
+ * find the routers on the path, like traceroute, and the RTT of each hop is
+ * collected in a histogram.
+ */
+
+#pragma once
+
+#include <netinet/in.h>
+#include <semaphore.h>
+#include <sys/types.h>
+#include <chrono>
+#include <mutex>
+#include <vector>
+
+/* Hops probed at most */
+#define PROBE_MAX_HOPS 30
+/* Time(in milliseconds) to wait for the reply of a probe */
+#define PROBE_TIMEOUT 1000
+/* Bucket i of a histogram counts RTTs in [2^i, 2^(i+1)) microseconds. */
+#define RTT_BUCKETS 24
+
+/**
+ * @brief RTT statistics of a hop.
+ *
+ * @param addr Address of the router or host that replied.
+ * @param reached Whether the hop is the destination.
+ * @param sent Number of probes sent.
+ * @param received Number of replies.
+ * @param min_rtt, max_rtt, sum_rtt RTTs of the replies in microseconds.
+ */
+struct HopStats
+{
+    struct in_addr addr;
+    bool reached;
+    int sent;
+    int received;
+    int64_t min_rtt;
+    int64_t max_rtt;
+    int64_t sum_rtt;
+    unsigned int histogram[RTT_BUCKETS];
+
+    HopStats();
+    void record(int64_t rtt);
+    void print(int ttl) const;
+};
+
+/**
+ * @brief Reply to a probe.
+ */
+struct ProbeReply
+{
+    struct in_addr addr;
+    bool reached;
+    int64_t rtt;
+};
+
+/**
+ * @brief Matches ICMP replies to the outstanding probe. Probes are sent one
+ * at a time, so only the sequence number of the last one is kept, and the
+ * receiving thread needs no allocation to match a reply.
+ */
+class Prober
+{
+private:
+    std::mutex mutex;      // Protects states of the outstanding probe
+    std::mutex probe_mutex; // Serializes users of the prober
+    sem_t semaphore;
+    u_short id;
+    u_short seq;
+    bool waiting;
+    std::chrono::steady_clock::time_point sent_time;
+    ProbeReply reply;
+public:
+    Prober();
+    ~Prober();
+    void lock();
+    void unlock();
+    u_short getID();
+    u_short start();
+    bool wait(int timeout_milliseconds, ProbeReply *result);
+    void handleReply(u_short reply_id, u_short reply_seq,
+                     struct in_addr addr, bool reached);
+};
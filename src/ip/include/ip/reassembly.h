@@ -0,0 +1,88 @@
+/**
+ * @file reassembly.h
+ * @brief Reassembly of fragmented IPv4 datagrams, using the hole descriptor
+ * list of RFC815.
+ */
+
+#pragma once
+
+#include "packet.h"
+#include <netinet/ip.h>
+#include <sys/types.h>
+#include <chrono>
+#include <list>
+#include <unordered_map>
+#include <vector>
+
+/* Maximum number of datagrams being reassembled at the same time */
+#define REASSEMBLY_MAX_FLOWS 64
+/* Time(in milliseconds) to wait for the rest of a datagram */
+#define REASSEMBLY_TIMEOUT 30000
+/* IPv4 datagrams are at most 65535 bytes */
+#define MAX_DATAGRAM_LEN 65535
+
+/**
+ * @brief Fields identifying the fragments of the same datagram.
+ */
+struct ReassemblyKey
+{
+    unsigned int src_addr;
+    unsigned int dst_addr;
+    u_short id;
+    u_char protocol;
+    bool operator==(const ReassemblyKey &key) const;
+};
+
+struct ReassemblyKeyHash
+{
+    size_t operator()(const ReassemblyKey &key) const;
+};
+
+/**
+ * @brief A datagram being reassembled.
+ *
+ * @param holes Hole descriptors. Each is a range [first, last] of bytes in
+ * the payload that hasn't arrived yet.
+ * @param header IPv4 header of the first fragment, without options.
+ * @param data Payload received so far.
+ * @param end Length of the payload, known once the last fragment arrives.
+ * @param deadline Time when the datagram is given up.
+ */
+class ReassemblyFlow
+{
+public:
+    ReassemblyKey key;
+    std::list<std::pair<int, int>> holes;
+    IPv4Header header;
+    bool has_header;
+    std::vector<u_char> data;
+    int end;
+    std::chrono::steady_clock::time_point deadline;
+    ReassemblyFlow(const ReassemblyKey &k);
+    ~ReassemblyFlow() = default;
+};
+
+/**
+ * @brief Table of datagrams being reassembled. It holds at most
+ * `REASSEMBLY_MAX_FLOWS` of them, evicting the oldest one when it's full,
+ * and drops those that aren't completed in `REASSEMBLY_TIMEOUT`.
+ *
+ * @note It's only used on the receive path, serialized by 
+ * `EpollServer::rx_mutex`, so it isn't locked.
+ */
+class Reassembler
+{
+private:
+    // Flows in the order they were created, so the oldest is at the front.
+    std::list<ReassemblyFlow> flows;
+    std::unordered_map<ReassemblyKey, std::list<ReassemblyFlow>::iterator,
+                       ReassemblyKeyHash> key2flow;
+    // The last datagram completed.
+    std::vector<u_char> complete;
+    void expire(std::chrono::steady_clock::time_point now);
+    void erase(std::list<ReassemblyFlow>::iterator it);
+public:
+    Reassembler();
+    ~Reassembler() = default;
+    const u_char *addFragment(const u_char *buf, int len, int *total_len);
+};
@@ -9,9 +9,14 @@
 #include <ethernet/frame.h>
 #include "packet.h"
 #include <netinet/ip.h>
+#include <atomic>
 #include <mutex>
 #include <vector>
 
+/* Number of entries in the flow cache(a power of 2) */
+#define FLOW_CACHE_BITS 8
+#define FLOW_CACHE_SIZE (1 << FLOW_CACHE_BITS)
+
 /**
  * @brief Routing table entry.
  */
@@ -21,6 +26,16 @@ typedef struct{
     int device_id;
 }Entry;
 
+/**
+ * @brief Flow cache entry. It remembers the device a destination was routed 
+ * to, and is valid as long as the routing table stays at `generation`.
+ */
+typedef struct{
+    struct in_addr dst_addr;
+    int device_id;
+    unsigned int generation;
+}FlowCacheEntry;
+
 class DeviceManager;
 
 /**
@@ -31,6 +46,11 @@ class RoutingTable
 private:
     std::mutex table_mutex;
     std::vector<Entry> routing_table;
+    // Bumped whenever `routing_table` changes.
+    std::atomic<unsigned int> generation;
+    // Direct-mapped cache in front of `findEntry`. Only used on the receive 
+    // path, which `EpollServer::rx_mutex` serializes, so it needs no lock.
+    FlowCacheEntry flow_cache[FLOW_CACHE_SIZE];
 
     // For link state
     unsigned int seq;
@@ -53,6 +73,7 @@ public:
     RoutingTable(DeviceManager *dm);
     ~RoutingTable();
     int findEntry(struct in_addr addr);
+    int lookupFlow(struct in_addr addr);
     int setMyIP();
     bool findMyIP(struct in_addr addr);
     void updateStates();
@@ -4,8 +4,11 @@
 
 #include <ethernet/endian.h>
 #include <ethernet/frame.h>
+#include <ip/icmp.h>
 #include <ip/ip.h>
 #include <ip/packet.h>
+#include <ip/reassembly.h>
+#include <arpa/inet.h>
 #include <algorithm>
 #include <iostream>
 #include <thread>
@@ -14,7 +17,7 @@
  * @brief Constructor of `NetworkLayer`. Initialize device manager.
  */
 NetworkLayer::NetworkLayer(TransportLayer *trans): 
-    callback(NULL), device_manager(this, trans), 
+    callback(NULL), device_manager(this, trans), next_id(0), batching(false),
     timer_running(false), routing_table(&device_manager)
 {
     if(device_manager.addAllDevice() == -1){
@@ -37,29 +40,40 @@ NetworkLayer::~NetworkLayer()
 }
 
 /**
- * @brief Send an IP packet to specified host.
+ * @brief Send an IP packet to specified host. Packets larger than the path 
+ * MTU are fragmented.
  *
  * @param src Source IP address.
  * @param dest Destination IP address.
  * @param proto Value of `protocol` field in IP header.
  * @param buf pointer to IP payload
  * @param len Length of IP payload
+ * @param ttl Value of `ttl` field in IP header.
+ * @param tos Value of `service_type` field in IP header. Its DSCP selects 
+ * the class of the packet in the egress scheduler.
  * @return 0 on success, -1 on error.
  */
 int 
 NetworkLayer::sendIPPacket(const struct in_addr src, const struct in_addr dest,
-                           int proto, const void* buf, int len)
+                           int proto, const void* buf, int len, int ttl, 
+                           int tos)
 {
     int rc;
 
     // Check protocol
-    if((proto != IPv4_PROTOCOL_TCP) && 
+    if((proto != IPv4_PROTOCOL_ICMP) &&
+       (proto != IPv4_PROTOCOL_TCP) && 
+       (proto != IPv4_PROTOCOL_UDP) &&
        (proto != IPv4_PROTOCOL_TESTING1) &&
        (proto != IPv4_PROTOCOL_TESTING2))
     {
         std::cerr << "Protocol " << proto << " not supported!" << std::endl;
         return -1;
     }
+    if(SIZE_IPv4 + len > MAX_DATAGRAM_LEN){
+        std::cerr << "IP payload too large: " << len << "!" << std::endl;
+        return -1;
+    }
 
     u_char *packet = new u_char[SIZE_IPv4 + len];
     memset(packet, 0, SIZE_IPv4 + len);
@@ -69,16 +83,17 @@ NetworkLayer::sendIPPacket(const struct in_addr src, const struct in_addr dest,
     // Version & IHL
     ipv4_header->version_IHL = IPv4_VERSION | DEFAULT_IHL;
     // Type of Service
-    ipv4_header->service_type = DEFAULT_TOS;
+    ipv4_header->service_type = tos;
     // Total Length
     u_short total_len = SIZE_IPv4 + len;
     ipv4_header->total_len = change_order(total_len);
-    // Identification
-    ipv4_header->id = DEFAULT_ID;
+    // Identification: unique for each packet so that fragments of different
+    // packets are never mixed up.
+    ipv4_header->id = change_order(next_id++);
     // Reserved bit, flags and Fragment Offset
     ipv4_header->flags_offset = DEFAULT_FLAGS_OFFSET;
     // Time to Live
-    ipv4_header->ttl = DEFAULT_TTL;
+    ipv4_header->ttl = ttl;
     // Protocol
     ipv4_header->protocol = proto;
     // Checksum: firstly set to 0
@@ -86,14 +101,13 @@ NetworkLayer::sendIPPacket(const struct in_addr src, const struct in_addr dest,
     // Addresses
     ipv4_header->src_addr = src;
     ipv4_header->dst_addr = dest;
-    // Calculate checksum
-    u_short checksum = calculate_checksum((const u_short *)ipv4_header, 
-                                           SIZE_IPv4 >> 1);
-    ipv4_header->checksum = checksum;
     
     // Send packets
     if(proto == IPv4_PROTOCOL_TESTING1 || proto == IPv4_PROTOCOL_TESTING2){
         // Broadcast
+        ipv4_header->checksum = calculate_checksum(
+            (const u_short *)ipv4_header, SIZE_IPv4 >> 1
+        );
         device_manager.sendFrameAll(
             (const void *)packet, total_len, ETHTYPE_IPv4, dest
         );
@@ -107,9 +121,21 @@ NetworkLayer::sendIPPacket(const struct in_addr src, const struct in_addr dest,
             delete[] packet;
             return -1;
         }
-        rc = device_manager.sendFrame((const void *)packet, total_len, 
-                                      ETHTYPE_IPv4, ipv4_header->dst_addr, 
-                                      device_id);
+        int mtu = clampPathMTU(ipv4_header->dst_addr, 
+                               device_manager.getMTU(device_id));
+        if(total_len > mtu){
+            // Fragments of our own packets may be fragmented again.
+            ipv4_header->flags_offset = 0;
+            rc = sendFragments(packet, mtu, device_id);
+        }
+        else{
+            ipv4_header->checksum = calculate_checksum(
+                (const u_short *)ipv4_header, SIZE_IPv4 >> 1
+            );
+            rc = device_manager.sendFrame((const void *)packet, total_len, 
+                                          ETHTYPE_IPv4, ipv4_header->dst_addr, 
+                                          device_id);
+        }
         if(rc == -1){
             std::cerr << "Send frame Error!" << std::endl;
             delete[] packet;
@@ -121,6 +147,58 @@ NetworkLayer::sendIPPacket(const struct in_addr src, const struct in_addr dest,
     return 0;
 }
 
+/**
+ * @brief Split an IP packet into fragments that fit in `mtu` and send them.
+ *
+ * @param packet Pointer to the IP packet. Its header checksum is ignored.
+ * @param mtu Maximum length of each fragment.
+ * @param device_id ID of the device to send fragments on.
+ * @return 0 on success, -1 on error.
+ * 
+ * @note Options of the packet aren't copied into any fragment.
+ * @see RFC791(Fragmentation and Reassembly)
+ */
+int 
+NetworkLayer::sendFragments(const u_char *packet, int mtu, int device_id)
+{
+    const IPv4Header *ipv4_header = (const IPv4Header *)packet;
+    int header_len = GET_IHL(ipv4_header->version_IHL) << 2;
+    int data_len = (u_short)change_order(ipv4_header->total_len) - header_len;
+    u_short flags_offset = change_order(ipv4_header->flags_offset);
+    int base = (flags_offset & IP_OFFMASK) << 3;
+    bool more = flags_offset & IP_MF;
+    // Every fragment but the last carries a multiple of 8 bytes.
+    int max_len = (mtu - SIZE_IPv4) & ~7;
+
+    u_char *fragment = new u_char[SIZE_IPv4 + max_len];
+    IPv4Header *fragment_header = (IPv4Header *)fragment;
+    for(int offset = 0; offset < data_len; offset += max_len){
+        int len = std::min(max_len, data_len - offset);
+        memcpy(fragment, packet, SIZE_IPv4);
+        memcpy(fragment + SIZE_IPv4, packet + header_len + offset, len);
+        fragment_header->version_IHL = IPv4_VERSION | DEFAULT_IHL;
+        fragment_header->total_len = change_order((u_short)(SIZE_IPv4 + len));
+        flags_offset = ((base + offset) >> 3) & IP_OFFMASK;
+        if(more || (offset + len < data_len)){
+            flags_offset |= IP_MF;
+        }
+        fragment_header->flags_offset = change_order(flags_offset);
+        fragment_header->checksum = 0;
+        fragment_header->checksum = calculate_checksum(
+            (const u_short *)fragment_header, SIZE_IPv4 >> 1
+        );
+        if(device_manager.sendFrame(fragment, SIZE_IPv4 + len, ETHTYPE_IPv4,
+                                    fragment_header->dst_addr, 
+                                    device_id) == -1)
+        {
+            delete[] fragment;
+            return -1;
+        }
+    }
+    delete[] fragment;
+    return 0;
+}
+
 /**
  * @brief Register a callback function to be called each time an IP
  * packet was received.
@@ -167,6 +245,7 @@ NetworkLayer::setRoutingTable(const struct in_addr dest,
     }
     if(!exist){
         routing_table.routing_table.push_back(e);
+        routing_table.generation++;
     }
     routing_table.table_mutex.unlock();
     return 0;
@@ -179,6 +258,10 @@ NetworkLayer::setRoutingTable(const struct in_addr dest,
  * @param buf Pointer to the IP packet.
  * @param len Length of the IP packet.
  * @param device_id ID of the device receiving the packet.
+ * @param header_len Set to the length of the IP header.
+ * @param packet Set to the packet whose payload should be passed to 
+ * transport layer. It's `buf` unless the packet completes a fragmented 
+ * datagram, in which case it's the reassembled datagram.
  * @return Length after it consumes from buf, i.e., length that should be 
  * passed to transport layer. 0 if the frame doesn't need to be passed.
  * -1 on error.
@@ -188,7 +271,7 @@ NetworkLayer::setRoutingTable(const struct in_addr dest,
  */
 int 
 NetworkLayer::callBack(const u_char *buf, int len, int device_id, 
-                       int *header_len)
+                       int *header_len, const u_char **packet)
 {
     int rest_len;
     IPv4Header ipv4_header = *(IPv4Header *)buf;
@@ -213,10 +296,8 @@ NetworkLayer::callBack(const u_char *buf, int len, int device_id,
     // 0 of the Ethernet frame.
     rest_len = (u_short)change_order(ipv4_header.total_len) - *header_len;
 
-    // Ignore Type of Service, Total Length, Identification.
-    // NOTE: DF, MF, and Fragment Offset are also ignored because packets that 
-    // are fragmented have already been dropped by link layer, so we don't 
-    // care about fragmentation here.
+    // Ignore Type of Service, Total Length.
+    // Identification, MF, and Fragment Offset are used for reassembly below.
     // Reserved bit
     if(GET_RESERVED(ipv4_header.flags_offset) != RESERVED_BIT){
         std::cerr << "Reserved bit is not 0!" << std::endl;
@@ -227,12 +308,11 @@ NetworkLayer::callBack(const u_char *buf, int len, int device_id,
     // NOTE: In RFC791, it indicates the maximum time the datagram is allowed 
     // to remain in the internet system. But in practice, it is usually 
     // decreased once per hop.(And that's how IPv6 works.) For simplicity,
-    // I'll just do that.
+    // I'll just do that. It's decreased in `forwardPacket`.
     if(ipv4_header.ttl == 0){
         std::cout << "Packet timeout!" << std::endl;
         return 0;
     }
-    ipv4_header.ttl -= 1;
 
     // Header Checksum
     u_short sum = calculate_checksum((const u_short *)buf, (*header_len) >> 1);
@@ -241,34 +321,64 @@ NetworkLayer::callBack(const u_char *buf, int len, int device_id,
         return -1;
     }
 
+    // Fragments
+    // Only the destination reassembles a datagram. Routers forward fragments 
+    // as they are.
+    const u_char *frame = buf;
+    *packet = buf;
+    u_short flags_offset = change_order(ipv4_header.flags_offset);
+    if((flags_offset & (IP_MF | IP_OFFMASK)) && 
+       routing_table.findMyIP(ipv4_header.dst_addr))
+    {
+        int total_len;
+        *packet = reassembler.addFragment(buf, len, &total_len);
+        if(*packet == NULL){
+            return 0;
+        }
+        buf = *packet;
+        len = total_len;
+        *header_len = SIZE_IPv4;
+        rest_len = total_len - SIZE_IPv4;
+    }
+
+    // Forward packets addressed to others. Routing messages are broadcast 
+    // and handled by every host.
+    if((ipv4_header.protocol != IPv4_PROTOCOL_TESTING1) &&
+       (ipv4_header.protocol != IPv4_PROTOCOL_TESTING2) &&
+       !routing_table.findMyIP(ipv4_header.dst_addr))
+    {
+        int to_device_id = routing_table.lookupFlow(ipv4_header.dst_addr);
+        if(to_device_id == -1){
+            u_char *dst_addr = (u_char *)&ipv4_header.dst_addr;
+            u_char *src_addr = (u_char *)&ipv4_header.src_addr;
+            printf("Can't route from %02x.%02x.%02x.%02x to "
+                   "%02x.%02x.%02x.%02x!\n",
+                   src_addr[0], src_addr[1], src_addr[2], src_addr[3],
+                   dst_addr[0], dst_addr[1], dst_addr[2], dst_addr[3]);
+            return -1;
+        }
+        rc = forwardPacket((u_char *)buf, len, device_id, to_device_id);
+        if(rc == -1){
+            std::cerr << "Routing error: frame sending failed!\n";
+            return -1;
+        }
+        return 0;
+    }
+
     // Protocol
     // See RFC790 & RFC3692 and 
     // https://www.iana.org/assignments/protocol-numbers/protocol-numbers.xhtml
     switch (ipv4_header.protocol)
     {
-    case IPv4_PROTOCOL_TCP:
-        if(!routing_table.findMyIP(ipv4_header.dst_addr)){
-            rest_len = 0;
-            int to_device_id = routing_table.findEntry(ipv4_header.dst_addr);
-            if(to_device_id == -1){
-                u_char *dst_addr = (u_char *)&ipv4_header.dst_addr;
-                u_char *src_addr = (u_char *)&ipv4_header.src_addr;
-                printf("Can't route from %02x.%02x.%02x.%02x to "
-                       "%02x.%02x.%02x.%02x!\n",
-                       src_addr[0], src_addr[1], src_addr[2], src_addr[3],
-                       dst_addr[0], dst_addr[1], dst_addr[2], dst_addr[3]);
-                return -1;
-            }
-            else{
-                rc = device_manager.sendFrame(buf, len, ETHTYPE_IPv4, 
-                                              ipv4_header.dst_addr, 
-                                              to_device_id);
-                if(rc == -1){
-                    std::cerr << "Routing error: frame sending failed!\n";
-                    return -1;
-                }
-            }
+    case IPv4_PROTOCOL_ICMP:
+        if(!handleICMP((u_char *)buf, *header_len, rest_len, buf == frame)){
+            return -1;
         }
+        rest_len = 0;
+        break;
+
+    case IPv4_PROTOCOL_TCP:
+    case IPv4_PROTOCOL_UDP:
         break;
 
     case IPv4_PROTOCOL_TESTING1:
@@ -295,6 +405,315 @@ NetworkLayer::callBack(const u_char *buf, int len, int device_id,
     return rest_len;
 }
 
+/**
+ * @brief Forward a received IP packet to the next hop. TTL is decreased in 
+ * the received buffer and the header checksum is patched incrementally. 
+ * Under light load, the frame is then sent in place without being copied. 
+ * Otherwise it's queued on the device, and sent with the rest of its batch 
+ * by `flushForward`.
+ * 
+ * @see setBatching
+ * 
+ * Packets larger than the MTU of the next hop are fragmented, unless they 
+ * have DF set, in which case an ICMP "fragmentation needed" message carrying 
+ * the MTU is sent back to the source. So is an ICMP "time exceeded" message 
+ * if TTL expires.
+ * 
+ * @param buf Pointer to the IP packet. It must be preceded by the Ethernet 
+ * header of the frame it arrived in.
+ * @param len Length of the IP packet. It may be longer than the packet due 
+ * to the padding of the Ethernet frame.
+ * @param in_device_id ID of the device the packet arrived on.
+ * @param device_id ID of the device to send the packet on.
+ * @return 0 on success, -1 on error. A packet dropped due to TTL or its size 
+ * counts as success.
+ */
+int 
+NetworkLayer::forwardPacket(u_char *buf, int len, int in_device_id, 
+                            int device_id)
+{
+    IPv4Header *ipv4_header = (IPv4Header *)buf;
+    if(ipv4_header->ttl <= 1){
+        std::cout << "Packet timeout!" << std::endl;
+        sendICMPError(buf, ICMPType::TIME_EXCEEDED, ICMP_CODE_TTL_EXCEEDED, 
+                      0, in_device_id);
+        return 0;
+    }
+
+    // TTL and Protocol share a 16-bit word of the header.
+    u_short *ttl_word = (u_short *)&ipv4_header->ttl;
+    u_short old_word = *ttl_word;
+    ipv4_header->ttl -= 1;
+    ipv4_header->checksum = update_checksum(ipv4_header->checksum, 
+                                            old_word, *ttl_word);
+
+    int total_len = (u_short)change_order(ipv4_header->total_len);
+    int mtu = device_manager.getMTU(device_id);
+    if(total_len > mtu){
+        if(change_order(ipv4_header->flags_offset) & IP_DF){
+            std::cout << "Packet too large to forward!" << std::endl;
+            sendICMPError(buf, ICMPType::DEST_UNREACHABLE, 
+                          ICMP_CODE_FRAG_NEEDED, mtu, in_device_id);
+            return 0;
+        }
+        return sendFragments(buf, mtu, device_id);
+    }
+
+    if(!batching){
+        return device_manager.forwardFrame(buf - SIZE_ETHERNET, 
+                                           SIZE_ETHERNET + len, device_id);
+    }
+    return device_manager.queueFrame(buf - SIZE_ETHERNET, 
+                                     SIZE_ETHERNET + len, device_id);
+}
+
+/**
+ * @brief Send an ICMP error message about a received packet to its source.
+ * 
+ * @param buf Pointer to the IP packet causing the error.
+ * @param type Type of the ICMP message.
+ * @param code Code of the ICMP message.
+ * @param mtu MTU of the next hop, only used by "fragmentation needed".
+ * @param device_id ID of the device the packet arrived on. Its address is 
+ * the source of the message, so that traceroute reports the address of the 
+ * interface facing it.
+ * @return 0 on success, -1 on error. Nothing is sent about ICMP error 
+ * messages, broadcasts, or fragments other than the first one.
+ * 
+ * @see RFC792 & RFC1122(3.2.2) & RFC1191
+ */
+int 
+NetworkLayer::sendICMPError(const u_char *buf, int type, int code, 
+                            int mtu, int device_id)
+{
+    const IPv4Header *ipv4_header = (const IPv4Header *)buf;
+    int header_len = GET_IHL(ipv4_header->version_IHL) << 2;
+    int total_len = (u_short)change_order(ipv4_header->total_len);
+    if((change_order(ipv4_header->flags_offset) & IP_OFFMASK) ||
+       (ipv4_header->dst_addr.s_addr == IPv4_ADDR_BROADCAST))
+    {
+        return 0;
+    }
+    if(ipv4_header->protocol == IPv4_PROTOCOL_ICMP){
+        u_char icmp_type = buf[header_len];
+        if((icmp_type != ICMPType::ECHO_REQUEST) && 
+           (icmp_type != ICMPType::ECHO_REPLY))
+        {
+            return 0;
+        }
+    }
+
+    // ICMP header + IP header + the first 8 bytes of data
+    int quoted_len = std::min(total_len, header_len + ICMP_QUOTED_DATA);
+    int len = SIZE_ICMP + quoted_len;
+    u_char *message = new u_char[len];
+    memset(message, 0, SIZE_ICMP);
+    memcpy(message + SIZE_ICMP, buf, quoted_len);
+    ICMPHeader *icmp_header = (ICMPHeader *)message;
+    icmp_header->type = type;
+    icmp_header->code = code;
+    if((type == ICMPType::DEST_UNREACHABLE) && 
+       (code == ICMP_CODE_FRAG_NEEDED))
+    {
+        icmp_header->next_hop_mtu = change_order((u_short)mtu);
+    }
+    icmp_header->checksum = calculate_checksum(message, len);
+
+    int rc = sendIPPacket(getIP(device_id), ipv4_header->src_addr, 
+                          IPv4_PROTOCOL_ICMP, message, len);
+    delete[] message;
+    return rc;
+}
+
+/**
+ * @brief ICMP message handler. It answers echo requests, learns path MTUs 
+ * from "fragmentation needed" messages, and passes replies to probes to the 
+ * prober.
+ * 
+ * @param buf Pointer to the IP packet carrying the ICMP message.
+ * @param header_len Length of the IP header.
+ * @param len Length of the ICMP message.
+ * @param in_frame Whether the packet is in the frame it arrived in, i.e., it 
+ * isn't reassembled.
+ * @return true on success, false on failure.
+ * 
+ * @see RFC792 & RFC1191
+ */
+bool 
+NetworkLayer::handleICMP(u_char *buf, int header_len, int len, bool in_frame)
+{
+    const u_char *message = buf + header_len;
+    const IPv4Header *ipv4_header = (const IPv4Header *)buf;
+    if(len < SIZE_ICMP){
+        std::cerr << "ICMP message too short!" << std::endl;
+        return false;
+    }
+    if(calculate_checksum(message, len) != 0){
+        std::cerr << "ICMP checksum error!" << std::endl;
+        return false;
+    }
+
+    const ICMPHeader *icmp_header = (const ICMPHeader *)message;
+    const ICMPEcho *echo = (const ICMPEcho *)message;
+    switch (icmp_header->type)
+    {
+    case ICMPType::ECHO_REQUEST:
+        return handleEcho(buf, header_len, len, in_frame);
+
+    case ICMPType::ECHO_REPLY:
+        prober.handleReply(change_order(echo->id), change_order(echo->seq),
+                           ipv4_header->src_addr, true);
+        break;
+
+    case ICMPType::DEST_UNREACHABLE:
+    case ICMPType::TIME_EXCEEDED:
+    {
+        // Error messages quote the IP header and 8 bytes of the packet.
+        if(len < SIZE_ICMP + SIZE_IPv4){
+            std::cerr << "ICMP message too short!" << std::endl;
+            return false;
+        }
+        const IPv4Header *quoted = (const IPv4Header *)(message + SIZE_ICMP);
+        int quoted_header_len = GET_IHL(quoted->version_IHL) << 2;
+        if((icmp_header->type == ICMPType::DEST_UNREACHABLE) &&
+           (icmp_header->code == ICMP_CODE_FRAG_NEEDED))
+        {
+            // Routers not following RFC1191 leave the MTU 0. Fall back to 
+            // the minimum then.
+            int mtu = (u_short)change_order(icmp_header->next_hop_mtu);
+            mtu = std::max(mtu, MIN_MTU);
+            pmtu_mutex.lock();
+            auto it = pmtu_cache.find(quoted->dst_addr.s_addr);
+            if((it == pmtu_cache.end()) || (mtu < it->second.first)){
+                pmtu_cache[quoted->dst_addr.s_addr] = std::make_pair(mtu, 
+                    std::chrono::steady_clock::now() + 
+                    std::chrono::milliseconds(PMTU_TIMEOUT));
+                std::cout << "Path MTU to " << inet_ntoa(quoted->dst_addr);
+                std::cout << " reduced to " << mtu << "." << std::endl;
+            }
+            pmtu_mutex.unlock();
+        }
+        if((quoted->protocol == IPv4_PROTOCOL_ICMP) &&
+           (len >= SIZE_ICMP + quoted_header_len + SIZE_ICMP))
+        {
+            const ICMPEcho *quoted_echo = (const ICMPEcho *)(
+                message + SIZE_ICMP + quoted_header_len
+            );
+            if(quoted_echo->type == ICMPType::ECHO_REQUEST){
+                prober.handleReply(change_order(quoted_echo->id), 
+                                   change_order(quoted_echo->seq),
+                                   ipv4_header->src_addr, false);
+            }
+        }
+        break;
+    }
+
+    default:
+        break;
+    }
+    return true;
+}
+
+/**
+ * @brief Answer an echo request. The request is turned into the reply in 
+ * place and queued on the device like a forwarded packet, so no memory is 
+ * allocated. The checksum of the ICMP message is patched incrementally.
+ * 
+ * @param buf Pointer to the IP packet carrying the echo request.
+ * @param header_len Length of the IP header.
+ * @param len Length of the ICMP message.
+ * @param in_frame Whether the packet is in the frame it arrived in. If not, 
+ * or the reply doesn't fit in the device, it's sent by `sendIPPacket`.
+ * @return true on success, false on failure.
+ */
+bool 
+NetworkLayer::handleEcho(u_char *buf, int header_len, int len, bool in_frame)
+{
+    IPv4Header *ipv4_header = (IPv4Header *)buf;
+    ICMPEcho *echo = (ICMPEcho *)(buf + header_len);
+
+    // Type and Code share a 16-bit word.
+    u_short *type_word = (u_short *)echo;
+    u_short old_word = *type_word;
+    echo->type = ICMPType::ECHO_REPLY;
+    echo->checksum = update_checksum(echo->checksum, old_word, *type_word);
+
+    struct in_addr src_addr = ipv4_header->dst_addr;
+    struct in_addr dst_addr = ipv4_header->src_addr;
+    int device_id = routing_table.lookupFlow(dst_addr);
+    if(device_id == -1){
+        std::cerr << "Can't route echo reply to " << inet_ntoa(dst_addr);
+        std::cerr << "!" << std::endl;
+        return false;
+    }
+    int total_len = header_len + len;
+    if(!in_frame || (total_len > device_manager.getMTU(device_id))){
+        return sendIPPacket(src_addr, dst_addr, IPv4_PROTOCOL_ICMP, 
+                            echo, len) == 0;
+    }
+
+    ipv4_header->src_addr = src_addr;
+    ipv4_header->dst_addr = dst_addr;
+    ipv4_header->id = change_order(next_id++);
+    ipv4_header->ttl = DEFAULT_TTL;
+    ipv4_header->checksum = 0;
+    ipv4_header->checksum = calculate_checksum((const u_short *)ipv4_header,
+                                               header_len >> 1);
+    return device_manager.queueFrame(buf - SIZE_ETHERNET, 
+                                     SIZE_ETHERNET + total_len, 
+                                     device_id) == 0;
+}
+
+/**
+ * @brief Limit an MTU to the path MTU learned for a destination, if there is 
+ * one that hasn't expired.
+ * 
+ * @param dest Destination IP address.
+ * @param mtu MTU of the device sending to `dest`.
+ * @return The smaller one.
+ */
+int 
+NetworkLayer::clampPathMTU(const struct in_addr dest, int mtu)
+{
+    pmtu_mutex.lock();
+    auto it = pmtu_cache.find(dest.s_addr);
+    if(it != pmtu_cache.end()){
+        if(it->second.second <= std::chrono::steady_clock::now()){
+            pmtu_cache.erase(it);
+        }
+        else{
+            mtu = std::min(mtu, it->second.first);
+        }
+    }
+    pmtu_mutex.unlock();
+    return mtu;
+}
+
+/**
+ * @brief Choose how `forwardPacket` sends the packets of a receive round. 
+ * A frame captured by libpcap is only valid until the next capture, so 
+ * sending it in place means a send per packet, while batching costs a copy 
+ * per packet but sends a batch with one system call. The former pays off 
+ * when few packets arrive per round.
+ * 
+ * @param batch Whether to batch forwarded packets.
+ */
+void 
+NetworkLayer::setBatching(bool batch)
+{
+    batching = batch;
+}
+
+/**
+ * @brief Send all packets queued by `forwardPacket`. Called by the receiving 
+ * thread after it processes a batch of frames.
+ */
+void 
+NetworkLayer::flushForward()
+{
+    device_manager.flushFrames();
+}
+
 /**
  * @brief Used for sending routing messages.
  * @param interval_seconds 
@@ -382,7 +801,8 @@ NetworkLayer::sendHelloPacket()
         packet[IPv4_ADDR_LEN] = 0x01; // is_request
         packet[IPv4_ADDR_LEN + 2] = 60u;
         sendIPPacket(routing_table.my_IP_addrs[0], dest, 
-                     IPv4_PROTOCOL_TESTING1, packet, min_len);
+                     IPv4_PROTOCOL_TESTING1, packet, min_len, DEFAULT_TTL, 
+                     CONTROL_TOS);
         delete[] packet;
     }
     return true;
@@ -438,7 +858,8 @@ NetworkLayer::sendLinkStatePacket()
             offset += 4;
         }
         sendIPPacket(routing_table.my_IP_addrs[0], dest, 
-                     IPv4_PROTOCOL_TESTING2, packet, len);
+                     IPv4_PROTOCOL_TESTING2, packet, len, DEFAULT_TTL, 
+                     CONTROL_TOS);
         delete[] packet;
     }
     return true;
@@ -595,6 +1016,137 @@ NetworkLayer::getIP()
     return routing_table.my_IP_addrs[0];
 }
 
+/**
+ * @brief Get the IP address of device DEVICE_ID, or the first one if it has 
+ * none.
+ */
+struct in_addr 
+NetworkLayer::getIP(int device_id)
+{
+    for(size_t i = 0; i < routing_table.device_ids.size(); i++){
+        if(routing_table.device_ids[i] == device_id){
+            return routing_table.my_IP_addrs[i];
+        }
+    }
+    return getIP();
+}
+
+/**
+ * @brief Get MTU of the device packets to DEST are sent on.
+ * 
+ * @return MTU on success, -1 if DEST is unreachable.
+ */
+int 
+NetworkLayer::getMTU(const struct in_addr dest)
+{
+    int device_id = routing_table.findEntry(dest);
+    if(device_id == -1){
+        return -1;
+    }
+    return device_manager.getMTU(device_id);
+}
+
+/**
+ * @brief Get the path MTU to DEST, i.e., MTU of the device packets to DEST 
+ * are sent on, reduced by ICMP "fragmentation needed" messages.
+ * 
+ * @return Path MTU on success, -1 if DEST is unreachable.
+ * @see RFC1191
+ */
+int 
+NetworkLayer::getPathMTU(const struct in_addr dest)
+{
+    int mtu = getMTU(dest);
+    if(mtu == -1){
+        return -1;
+    }
+    return clampPathMTU(dest, mtu);
+}
+
+/**
+ * @brief Check whether the device packets to DEST are sent on has room in 
+ * its egress queues. Senders that can wait should stop sending otherwise.
+ */
+bool 
+NetworkLayer::isWritable(const struct in_addr dest)
+{
+    int device_id = routing_table.findEntry(dest);
+    if(device_id == -1){
+        return true;
+    }
+    return device_manager.isWritable(device_id);
+}
+
+/**
+ * @brief Poll the device packets from SRC are expected on, in the calling 
+ * thread. All devices are polled if SRC is unspecified or unreachable.
+ * 
+ * @return Number of frames received.
+ */
+int 
+NetworkLayer::busyPoll(const struct in_addr src)
+{
+    int device_id = -1;
+    if(src.s_addr != 0){
+        device_id = routing_table.findEntry(src);
+    }
+    return device_manager.busyPoll(device_id);
+}
+
+/**
+ * @brief Probe the path to DEST with ICMP echo requests. For each TTL from 1 
+ * up, COUNT requests are sent one after another. Routers where TTL expires 
+ * answer with "time exceeded" and DEST answers with echo replies, which ends 
+ * probing.
+ * 
+ * @param dest Destination IP address.
+ * @param max_hops Maximum TTL to probe, at most `PROBE_MAX_HOPS`.
+ * @param count Number of probes per hop.
+ * @param hops Set to the statistics of each hop. hops[i] is of TTL i + 1.
+ * @return Number of hops to DEST, or -1 if it wasn't reached.
+ */
+int 
+NetworkLayer::probe(const struct in_addr dest, int max_hops, int count, 
+                    std::vector<HopStats> &hops)
+{
+    ICMPEcho echo;
+    ProbeReply reply;
+    int ret = -1;
+    hops.clear();
+    max_hops = std::min(max_hops, PROBE_MAX_HOPS);
+
+    prober.lock();
+    for(int ttl = 1; (ttl <= max_hops) && (ret == -1); ttl++){
+        HopStats stats;
+        for(int i = 0; i < count; i++){
+            echo.type = ICMPType::ECHO_REQUEST;
+            echo.code = 0;
+            echo.id = change_order(prober.getID());
+            echo.seq = change_order(prober.start());
+            echo.checksum = 0;
+            echo.checksum = calculate_checksum((const u_char *)&echo, 
+                                               SIZE_ICMP);
+            stats.sent++;
+            if(sendIPPacket(getIP(), dest, IPv4_PROTOCOL_ICMP, &echo, 
+                            SIZE_ICMP, ttl) == -1)
+            {
+                continue;
+            }
+            if(prober.wait(PROBE_TIMEOUT, &reply)){
+                stats.addr = reply.addr;
+                stats.reached = stats.reached || reply.reached;
+                stats.record(reply.rtt);
+            }
+        }
+        hops.push_back(stats);
+        if(stats.reached){
+            ret = ttl;
+        }
+    }
+    prober.unlock();
+    return ret;
+}
+
 /**
  * @brief Find whether ADDR is one of the host's IP address.
  */
@@ -20,4 +20,41 @@ calculate_checksum(const u_short *header, int len)
     }
     
     return change_order((u_short)~sum);
+}
+
+u_short 
+calculate_checksum(const u_char *segment, int len)
+{
+    size_t sum = 0;
+    size_t num = 0;
+    const u_short *seg_short = (const u_short *)segment;
+    for(int i = 0; i < len / 2; i++){
+        num = ((seg_short[i] & 0xff) << 8) | ((seg_short[i] & 0xff00) >> 8);
+        sum += num;
+    }
+    if(len % 2){
+        sum += (size_t)segment[len - 1] << 8;
+    }
+    while(sum >> 16){
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+    return change_order((u_short)~sum);
+}
+
+/**
+ * @note One's complement addition is independent of byte order, so the words 
+ * are used as they are stored and the result has the same byte order.
+ */
+u_short 
+update_checksum(u_short checksum, u_short old_word, u_short new_word)
+{
+    // HC' = ~(~HC + ~m + m')
+    unsigned int sum = (u_short)~checksum;
+    sum += (u_short)~old_word;
+    sum += new_word;
+    while(sum >> 16){
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+
+    return (u_short)~sum;
 }
\ No newline at end of file
@@ -0,0 +1,169 @@
+/**
+ * @file probe.cpp
+ */
+
+#include <ip/probe.h>
+#include <arpa/inet.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+HopStats::HopStats():
+    addr({0}), reached(false), sent(0), received(0), min_rtt(INT64_MAX),
+    max_rtt(0), sum_rtt(0)
+{
+    memset(histogram, 0, sizeof(histogram));
+}
+
+/**
+ * @brief Record the RTT(in microseconds) of a reply.
+ */
+void 
+HopStats::record(int64_t rtt)
+{
+    received++;
+    min_rtt = std::min(min_rtt, rtt);
+    max_rtt = std::max(max_rtt, rtt);
+    sum_rtt += rtt;
+    int bucket = 0;
+    while((bucket + 1 < RTT_BUCKETS) && (rtt >> (bucket + 1))){
+        bucket++;
+    }
+    histogram[bucket]++;
+}
+
+/**
+ * @brief Print the statistics and the non-empty buckets of the histogram.
+ */
+void 
+HopStats::print(int ttl) const
+{
+    if(received == 0){
+        printf("%2d  *  (0/%d replies)\n", ttl, sent);
+        return;
+    }
+    printf("%2d  %s  (%d/%d replies) min/avg/max = %ld/%ld/%ld us\n",
+           ttl, inet_ntoa(addr), received, sent, min_rtt,
+           sum_rtt / received, max_rtt);
+    for(int i = 0; i < RTT_BUCKETS; i++){
+        if(histogram[i] != 0){
+            printf("      [%ld, %ld) us: %u\n", 1l << i, 1l << (i + 1),
+                   histogram[i]);
+        }
+    }
+}
+
+Prober::Prober(): seq(0), waiting(false)
+{
+    id = getpid() & 0xffff;
+    sem_init(&semaphore, 0, 0);
+}
+
+Prober::~Prober()
+{
+    sem_destroy(&semaphore);
+}
+
+/**
+ * @brief Gain exclusive use of the prober for a series of probes.
+ */
+void 
+Prober::lock()
+{
+    probe_mutex.lock();
+}
+
+void 
+Prober::unlock()
+{
+    probe_mutex.unlock();
+}
+
+/**
+ * @brief Get the identifier of echo requests sent by the prober.
+ */
+u_short 
+Prober::getID()
+{
+    return id;
+}
+
+/**
+ * @brief Start a probe. Called just before the echo request is sent.
+ *
+ * @return Sequence number of the echo request.
+ */
+u_short 
+Prober::start()
+{
+    mutex.lock();
+    // Drop the wakeup of a late reply to the previous probe.
+    while(sem_trywait(&semaphore) == 0){
+    }
+    seq++;
+    waiting = true;
+    sent_time = std::chrono::steady_clock::now();
+    u_short ret = seq;
+    mutex.unlock();
+    return ret;
+}
+
+/**
+ * @brief Wait for the reply to the probe started last.
+ *
+ * @return true if it was received in time, false otherwise.
+ */
+bool 
+Prober::wait(int timeout_milliseconds, ProbeReply *result)
+{
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += timeout_milliseconds / 1000;
+    deadline.tv_nsec += (long)(timeout_milliseconds % 1000) * 1000000;
+    if(deadline.tv_nsec >= 1000000000){
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+    while(sem_timedwait(&semaphore, &deadline) == -1){
+        if(errno != EINTR){
+            mutex.lock();
+            waiting = false;
+            mutex.unlock();
+            return false;
+        }
+    }
+    mutex.lock();
+    *result = reply;
+    mutex.unlock();
+    return true;
+}
+
+/**
+ * @brief Handle an echo reply, or an error message quoting an echo request.
+ * Called by the receiving thread.
+ *
+ * @param reply_id Identifier of the echo request.
+ * @param reply_seq Sequence number of the echo request.
+ * @param addr Source address of the ICMP message.
+ * @param reached Whether it's an echo reply from the destination.
+ */
+void 
+Prober::handleReply(u_short reply_id, u_short reply_seq, struct in_addr addr,
+                    bool reached)
+{
+    auto now = std::chrono::steady_clock::now();
+    mutex.lock();
+    if(waiting && (reply_id == id) && (reply_seq == seq)){
+        waiting = false;
+        reply.addr = addr;
+        reply.reached = reached;
+        reply.rtt = std::chrono::duration_cast<std::chrono::microseconds>(
+            now - sent_time
+        ).count();
+        sem_post(&semaphore);
+    }
+    mutex.unlock();
+}
@@ -0,0 +1,166 @@
+/**
+ * @file reassembly.cpp
+ */
+
+#include <ethernet/endian.h>
+#include <ip/reassembly.h>
+#include <cstring>
+#include <iostream>
+
+bool 
+ReassemblyKey::operator==(const ReassemblyKey &key) const
+{
+    return (src_addr == key.src_addr) && (dst_addr == key.dst_addr) &&
+           (id == key.id) && (protocol == key.protocol);
+}
+
+size_t 
+ReassemblyKeyHash::operator()(const ReassemblyKey &key) const
+{
+    size_t h = key.src_addr;
+    h = h * 31 + key.dst_addr;
+    h = h * 31 + key.id;
+    h = h * 31 + key.protocol;
+    return h;
+}
+
+/**
+ * @brief Constructor of `ReassemblyFlow`. The whole datagram is a hole at
+ * first, and its end is unknown.
+ */
+ReassemblyFlow::ReassemblyFlow(const ReassemblyKey &k): 
+    key(k), holes(), has_header(false), data(), end(-1)
+{
+    holes.push_back(std::make_pair(0, MAX_DATAGRAM_LEN));
+    deadline = std::chrono::steady_clock::now() +
+               std::chrono::milliseconds(REASSEMBLY_TIMEOUT);
+}
+
+Reassembler::Reassembler(): flows(), key2flow(), complete()
+{
+}
+
+/**
+ * @brief Remove a flow from the table.
+ */
+void 
+Reassembler::erase(std::list<ReassemblyFlow>::iterator it)
+{
+    key2flow.erase(it->key);
+    flows.erase(it);
+}
+
+/**
+ * @brief Drop datagrams that have waited too long for their fragments. Since
+ * every flow waits for the same time, they expire in the order they were
+ * created.
+ */
+void 
+Reassembler::expire(std::chrono::steady_clock::time_point now)
+{
+    while(!flows.empty() && (flows.front().deadline <= now)){
+        std::cout << "Reassembly timeout!" << std::endl;
+        erase(flows.begin());
+    }
+}
+
+/**
+ * @brief Add a fragment to the datagram it belongs to.
+ *
+ * @param buf Pointer to the fragment, beginning with its IPv4 header.
+ * @param len Length of the buffer. It may be longer than the fragment due
+ * to the padding of the Ethernet frame.
+ * @param total_len Set to the length of the reassembled datagram.
+ * @return The reassembled datagram, with a 20-byte header, if `buf` was its
+ * last missing fragment. It's valid until the next call. NULL otherwise.
+ *
+ * @see RFC815
+ */
+const u_char * 
+Reassembler::addFragment(const u_char *buf, int len, int *total_len)
+{
+    const IPv4Header *ipv4_header = (const IPv4Header *)buf;
+    int header_len = GET_IHL(ipv4_header->version_IHL) << 2;
+    int packet_len = (u_short)change_order(ipv4_header->total_len);
+    if((packet_len > len) || (packet_len <= header_len)){
+        std::cerr << "Fragment length error!" << std::endl;
+        return NULL;
+    }
+    u_short flags_offset = change_order(ipv4_header->flags_offset);
+    bool more = flags_offset & IP_MF;
+    int first = (flags_offset & IP_OFFMASK) << 3;
+    int data_len = packet_len - header_len;
+    int last = first + data_len - 1;
+    if((more && (data_len & 7)) || (SIZE_IPv4 + last >= MAX_DATAGRAM_LEN)){
+        std::cerr << "Fragment offset error!" << std::endl;
+        return NULL;
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    expire(now);
+
+    // Find the flow, or create one.
+    ReassemblyKey key;
+    key.src_addr = ipv4_header->src_addr.s_addr;
+    key.dst_addr = ipv4_header->dst_addr.s_addr;
+    key.id = ipv4_header->id;
+    key.protocol = ipv4_header->protocol;
+    std::list<ReassemblyFlow>::iterator flow;
+    auto it = key2flow.find(key);
+    if(it != key2flow.end()){
+        flow = it->second;
+    }
+    else{
+        if(flows.size() >= REASSEMBLY_MAX_FLOWS){
+            std::cout << "Reassembly table full!" << std::endl;
+            erase(flows.begin());
+        }
+        flow = flows.emplace(flows.end(), key);
+        key2flow[key] = flow;
+    }
+
+    // Fill the holes the fragment covers.
+    for(auto hole = flow->holes.begin(); hole != flow->holes.end(); ){
+        int hole_first = hole->first, hole_last = hole->second;
+        if((first > hole_last) || (last < hole_first)){
+            hole++;
+            continue;
+        }
+        hole = flow->holes.erase(hole);
+        if(first > hole_first){
+            flow->holes.insert(hole, std::make_pair(hole_first, first - 1));
+        }
+        if((last < hole_last) && more){
+            flow->holes.insert(hole, std::make_pair(last + 1, hole_last));
+        }
+    }
+    if(flow->data.size() < (size_t)last + 1){
+        flow->data.resize(last + 1);
+    }
+    memcpy(flow->data.data() + first, buf + header_len, data_len);
+    if(first == 0){
+        memcpy(&flow->header, buf, SIZE_IPv4);
+        flow->has_header = true;
+    }
+    if(!more){
+        flow->end = last + 1;
+    }
+    if(!flow->holes.empty()){
+        return NULL;
+    }
+
+    // Build the datagram.
+    *total_len = SIZE_IPv4 + flow->end;
+    complete.resize(*total_len);
+    IPv4Header *header = (IPv4Header *)complete.data();
+    memcpy(header, &flow->header, SIZE_IPv4);
+    header->version_IHL = IPv4_VERSION | DEFAULT_IHL;
+    header->total_len = change_order((u_short)*total_len);
+    header->flags_offset = 0;
+    header->checksum = 0;
+    header->checksum = calculate_checksum((const u_short *)header,
+                                          SIZE_IPv4 >> 1);
+    memcpy(complete.data() + SIZE_IPv4, flow->data.data(), flow->end);
+    erase(flow);
+    return complete.data();
+}
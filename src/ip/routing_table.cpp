@@ -15,10 +15,12 @@
  * @brief Default constructor of `RoutingTable`.
  */
 RoutingTable::RoutingTable(DeviceManager *dm): 
-    routing_table(), my_IP_addrs(), link_state_list(), neighbors(), 
-    device_manager(dm), seq(0), device_ids(), 
-    table_mutex(), link_state_mutex(), neighbor_mutex()
+    table_mutex(), routing_table(), generation(1), seq(0), 
+    neighbor_mutex(), link_state_mutex(), neighbors(), link_state_list(), 
+    my_IP_addrs(), device_ids(), device_manager(dm)
 {
+    // Generation 0 is never used, so every entry starts invalid.
+    memset(flow_cache, 0, sizeof(flow_cache));
 }
 
 /**
@@ -60,6 +62,38 @@ RoutingTable::findEntry(struct in_addr addr)
     return device_id;
 }
 
+/**
+ * @brief Find the device to send a forwarded packet on, looking up the flow 
+ * cache before the routing table.
+ * 
+ * @param addr Destination IPv4 address.
+ * @return Device ID on success, -1 if not found.
+ * @note The flow cache isn't locked. It's only called on the receive path, 
+ * which `EpollServer::rx_mutex` serializes, whether it's run by the 
+ * receiving thread or by an application thread busy-polling.
+ */
+int 
+RoutingTable::lookupFlow(struct in_addr addr)
+{
+    // Fibonacci hashing of the address.
+    unsigned int idx = (addr.s_addr * 2654435761u) >> (32 - FLOW_CACHE_BITS);
+    FlowCacheEntry *e = &flow_cache[idx];
+    // Read the generation before `findEntry` so that a result found during 
+    // an update is never cached as up to date.
+    unsigned int gen = generation.load();
+    if((e->generation == gen) && (e->dst_addr.s_addr == addr.s_addr)){
+        return e->device_id;
+    }
+
+    int device_id = findEntry(addr);
+    if(device_id != -1){
+        e->dst_addr = addr;
+        e->device_id = device_id;
+        e->generation = gen;
+    }
+    return device_id;
+}
+
 /**
  * @brief Find all IP addresses on the host machine. And set IP addresses of 
  * every device.
@@ -322,6 +356,7 @@ RoutingTable::shortest_path()
             }
         }
     }
+    generation++;
     table_mutex.unlock();
 
 #ifdef PRINT
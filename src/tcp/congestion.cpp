@@ -0,0 +1,493 @@
+/**
+ * @file congestion.cpp
+ */
+
+#include <tcp/congestion.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+/**
+ * @brief Obtain time in microseconds.
+ */
+static int64_t 
+getTimeMicro()
+{
+    auto currentTime = std::chrono::high_resolution_clock::now();
+    auto duration = currentTime.time_since_epoch();
+    auto microseconds = \
+        std::chrono::duration_cast<std::chrono::microseconds>(duration);
+    return microseconds.count();
+}
+
+/**
+ * @brief Get the initial window of RFC3390, about 4KB.
+ */
+unsigned int 
+getInitialWindow(unsigned int mss)
+{
+    return std::min(4 * mss, std::max(2 * mss, 4380u));
+}
+
+/**
+ * @brief Create an instance of the congestion control algorithm NAME.
+ *
+ * @return The instance, or NULL if there is no such algorithm.
+ */
+CongestionControl * 
+createCongestionControl(const char *name)
+{
+    if((strcmp(name, "newreno") == 0) || (strcmp(name, "reno") == 0)){
+        return new NewReno();
+    }
+    if(strcmp(name, "cubic") == 0){
+        return new Cubic();
+    }
+    if(strcmp(name, "bbr") == 0){
+        return new BBR();
+    }
+    return NULL;
+}
+
+NewReno::NewReno(): bytes_acked(0) {}
+
+const char * 
+NewReno::getName() const
+{
+    return "newreno";
+}
+
+void 
+NewReno::init(CongestionState *state)
+{
+    state->cwnd = getInitialWindow(state->mss);
+    state->ssthresh = UINT32_MAX;
+    bytes_acked = 0;
+}
+
+void 
+NewReno::onAck(CongestionState *state, unsigned int acked)
+{
+    if(state->cwnd < state->ssthresh){
+        // Slow start, counting at most two MSS per ACK, as ACKs are 
+        // delayed(RFC3465 with L = 2).
+        state->cwnd += std::min(acked, 2 * state->mss);
+        return;
+    }
+    bytes_acked += acked;
+    if(bytes_acked >= state->cwnd){
+        bytes_acked -= state->cwnd;
+        state->cwnd += state->mss;
+    }
+}
+
+/**
+ * @brief Halve the window on a loss. After a timeout, it restarts from one
+ * segment in slow start.
+ */
+void 
+NewReno::onLoss(CongestionState *state, LossType::LossType type)
+{
+    state->ssthresh = std::max(state->inflight / 2, 2 * state->mss);
+    if(type == LossType::RTO){
+        state->cwnd = state->mss;
+    }
+    else{
+        state->cwnd = state->ssthresh;
+    }
+    bytes_acked = 0;
+}
+
+Cubic::Cubic(): 
+    w_max(0), k(0), origin(0), w_est(0), growth(0), epoch_start(0), 
+    min_rtt(0), round_start(0), last_ack(0), round_acked(0), round_bytes(0), 
+    curr_rtt(0), last_rtt(0), samples(0)
+{}
+
+const char * 
+Cubic::getName() const
+{
+    return "cubic";
+}
+
+void 
+Cubic::init(CongestionState *state)
+{
+    state->cwnd = getInitialWindow(state->mss);
+    state->ssthresh = UINT32_MAX;
+    w_max = k = origin = w_est = growth = 0;
+    epoch_start = 0;
+    min_rtt = 0;
+    last_rtt = 0;
+    startRound(state, getTimeMicro());
+}
+
+/**
+ * @brief Start a round of HyStart, which ends when the bytes in flight now 
+ * are acknowledged.
+ */
+void 
+Cubic::startRound(CongestionState *state, int64_t now)
+{
+    round_start = last_ack = now;
+    round_acked = 0;
+    round_bytes = std::max(state->inflight, state->mss);
+    if(samples >= HYSTART_MIN_SAMPLES){
+        last_rtt = curr_rtt;
+    }
+    curr_rtt = 0;
+    samples = 0;
+}
+
+/**
+ * @brief Check whether slow start should end, by the ACK train or the 
+ * increase of the RTT. 
+ */
+bool 
+Cubic::hystartDone(CongestionState *state, unsigned int acked, int64_t now)
+{
+    round_acked += acked;
+    if(round_acked >= round_bytes){
+        startRound(state, now);
+        return false;
+    }
+    if(state->cwnd < HYSTART_LOW_WINDOW * state->mss){
+        return false;
+    }
+    if(now - last_ack <= HYSTART_ACK_DELTA){
+        last_ack = now;
+        if((min_rtt != 0) && (now - round_start >= min_rtt / 2)){
+            return true;
+        }
+    }
+    if((samples >= HYSTART_MIN_SAMPLES) && (last_rtt != 0)){
+        int64_t thresh = std::min(std::max(last_rtt / 8, 
+                                           (int64_t)HYSTART_DELAY_MIN), 
+                                  (int64_t)HYSTART_DELAY_MAX);
+        if(curr_rtt >= last_rtt + thresh){
+            return true;
+        }
+    }
+    return false;
+}
+
+void 
+Cubic::onRTTSample(CongestionState *, int64_t rtt)
+{
+    if((min_rtt == 0) || (rtt < min_rtt)){
+        min_rtt = rtt;
+    }
+    if(samples < HYSTART_MIN_SAMPLES){
+        if((curr_rtt == 0) || (rtt < curr_rtt)){
+            curr_rtt = rtt;
+        }
+        samples++;
+    }
+}
+
+/**
+ * @brief Grow the window towards the target of the cubic function an RTT 
+ * later, or that of a Reno sender if it's larger.
+ */
+void 
+Cubic::onAck(CongestionState *state, unsigned int acked)
+{
+    int64_t now = getTimeMicro();
+    if(state->cwnd < state->ssthresh){
+        if(hystartDone(state, acked, now)){
+            state->ssthresh = state->cwnd;
+        }
+        else{
+            state->cwnd += std::min(acked, 2 * state->mss);
+            return;
+        }
+    }
+
+    double mss = state->mss;
+    double cwnd = state->cwnd / mss;
+    if(epoch_start == 0){
+        epoch_start = now;
+        if(cwnd < w_max){
+            k = std::cbrt((w_max - cwnd) / CUBIC_C);
+            origin = w_max;
+        }
+        else{
+            k = 0;
+            origin = cwnd;
+        }
+        w_est = cwnd;
+    }
+    double t = (now - epoch_start + min_rtt) / 1e6;
+    double target = origin + CUBIC_C * (t - k) * (t - k) * (t - k);
+    target = std::min(std::max(target, cwnd), 1.5 * cwnd);
+    // Reno-friendly region
+    const double alpha = 3 * (1 - CUBIC_BETA) / (1 + CUBIC_BETA);
+    w_est += alpha * (acked / mss) / cwnd;
+    target = std::max(target, w_est);
+
+    growth += (target - cwnd) * acked / cwnd;
+    if(growth >= 1){
+        unsigned int inc = (unsigned int)growth;
+        state->cwnd += inc;
+        growth -= inc;
+    }
+}
+
+/**
+ * @brief Reduce the window by `CUBIC_BETA`. With fast convergence, a loss 
+ * before the window reaches `w_max` again lowers `w_max` further to yield 
+ * bandwidth to new flows.
+ */
+void 
+Cubic::onLoss(CongestionState *state, LossType::LossType type)
+{
+    double cwnd = (double)state->cwnd / state->mss;
+    if(cwnd < w_max){
+        w_max = cwnd * (1 + CUBIC_BETA) / 2;
+    }
+    else{
+        w_max = cwnd;
+    }
+    state->ssthresh = std::max((unsigned int)(state->cwnd * CUBIC_BETA), 
+                               2 * state->mss);
+    if(type == LossType::RTO){
+        state->cwnd = state->mss;
+    }
+    else{
+        state->cwnd = state->ssthresh;
+    }
+    epoch_start = 0;
+    growth = 0;
+    startRound(state, getTimeMicro());
+}
+
+/* Pacing gains of the phases of PROBE_BW */
+static const double bbr_cycle_gains[BBR_CYCLE_LEN] = {
+    1.25, 0.75, 1, 1, 1, 1, 1, 1
+};
+
+BBR::BBR(): 
+    mode(BBRMode::STARTUP), pacing_gain(BBR_HIGH_GAIN), 
+    cwnd_gain(BBR_HIGH_GAIN), bw_samples(), bw_rounds(), btl_bw(0), 
+    min_rtt(0), min_rtt_stamp(0), round_count(0), next_round_delivered(0), 
+    round_start(false), full_bw(0), full_bw_cnt(0), filled_pipe(false), 
+    cycle_index(0), cycle_stamp(0), probe_rtt_done(0), prior_cwnd(0)
+{}
+
+const char * 
+BBR::getName() const
+{
+    return "bbr";
+}
+
+void 
+BBR::init(CongestionState *state)
+{
+    *this = BBR();
+    min_rtt_stamp = getTimeMicro();
+    state->cwnd = getInitialWindow(state->mss);
+    state->ssthresh = UINT32_MAX;
+    state->pacing_rate = 0;
+}
+
+/**
+ * @brief Get GAIN times the bandwidth-delay product, in bytes.
+ *
+ * @return 0 before the model has samples.
+ */
+double 
+BBR::getBDP(double gain)
+{
+    return gain * btl_bw * min_rtt / 1e6;
+}
+
+/**
+ * @brief Count rounds, and put the rate of RS into the windowed maximum.
+ */
+void 
+BBR::updateBandwidth(const RateSample *rs)
+{
+    round_start = false;
+    if(rs->prior_delivered >= next_round_delivered){
+        next_round_delivered = rs->prior_delivered + rs->delivered;
+        round_count++;
+        round_start = true;
+    }
+
+    double rate = rs->delivered * 1e6 / rs->interval;
+    int slot = round_count % BBR_BW_ROUNDS;
+    if((bw_rounds[slot] != round_count) || (rate > bw_samples[slot])){
+        bw_samples[slot] = rate;
+        bw_rounds[slot] = round_count;
+    }
+    btl_bw = 0;
+    for(int i = 0; i < BBR_BW_ROUNDS; i++){
+        if(round_count - bw_rounds[i] < BBR_BW_ROUNDS){
+            btl_bw = std::max(btl_bw, bw_samples[i]);
+        }
+    }
+}
+
+/**
+ * @brief Start PROBE_BW in a random phase other than the one draining.
+ */
+void 
+BBR::enterProbeBW(int64_t now)
+{
+    mode = BBRMode::PROBE_BW;
+    cwnd_gain = BBR_CWND_GAIN;
+    cycle_index = rand() % (BBR_CYCLE_LEN - 1);
+    if(cycle_index >= 1){
+        cycle_index++;
+    }
+    pacing_gain = bbr_cycle_gains[cycle_index];
+    cycle_stamp = now;
+}
+
+/**
+ * @brief Move between the modes of BBR.
+ */
+void 
+BBR::updateMode(CongestionState *state, int64_t now)
+{
+    if(!filled_pipe && round_start){
+        if(btl_bw >= full_bw * 1.25){
+            full_bw = btl_bw;
+            full_bw_cnt = 0;
+        }
+        else if(++full_bw_cnt >= 3){
+            filled_pipe = true;
+        }
+    }
+
+    switch (mode)
+    {
+    case BBRMode::STARTUP:
+        if(filled_pipe){
+            mode = BBRMode::DRAIN;
+            pacing_gain = 1 / BBR_HIGH_GAIN;
+            cwnd_gain = BBR_HIGH_GAIN;
+        }
+        break;
+
+    case BBRMode::DRAIN:
+        if(state->inflight <= getBDP(1)){
+            enterProbeBW(now);
+        }
+        break;
+
+    case BBRMode::PROBE_BW:
+        // Stay in the probing phase until the extra data is in flight, and 
+        // leave the draining one as soon as the queue is drained.
+        if((now - cycle_stamp > min_rtt) && 
+           ((pacing_gain <= 1) || (state->inflight >= getBDP(1.25))))
+        {
+            cycle_index = (cycle_index + 1) % BBR_CYCLE_LEN;
+            pacing_gain = bbr_cycle_gains[cycle_index];
+            cycle_stamp = now;
+        }
+        else if((pacing_gain < 1) && (state->inflight <= getBDP(1))){
+            cycle_index = (cycle_index + 1) % BBR_CYCLE_LEN;
+            pacing_gain = bbr_cycle_gains[cycle_index];
+            cycle_stamp = now;
+        }
+        break;
+
+    case BBRMode::PROBE_RTT:
+        if((probe_rtt_done == 0) && 
+           (state->inflight <= BBR_MIN_CWND * state->mss))
+        {
+            probe_rtt_done = now + BBR_PROBE_RTT_TIME;
+        }
+        else if((probe_rtt_done != 0) && (now >= probe_rtt_done)){
+            min_rtt_stamp = now;
+            state->cwnd = std::max(state->cwnd, prior_cwnd);
+            if(filled_pipe){
+                enterProbeBW(now);
+            }
+            else{
+                mode = BBRMode::STARTUP;
+                pacing_gain = cwnd_gain = BBR_HIGH_GAIN;
+            }
+        }
+        break;
+    }
+}
+
+/**
+ * @brief Update the model with RS, and pace at the bandwidth times the gain 
+ * of the mode.
+ */
+void 
+BBR::onRateSample(CongestionState *state, const RateSample *rs)
+{
+    int64_t now = getTimeMicro();
+    if(rs->interval <= 0){
+        return;
+    }
+    updateBandwidth(rs);
+
+    bool expired = now - min_rtt_stamp > BBR_MIN_RTT_WINDOW;
+    if((rs->rtt >= 0) && ((min_rtt == 0) || (rs->rtt <= min_rtt) || expired)){
+        min_rtt = rs->rtt;
+        min_rtt_stamp = now;
+    }
+    // The estimate went stale, so drain the queue to measure it afresh, 
+    // even though this sample refreshed it.
+    if(expired && (mode != BBRMode::PROBE_RTT)){
+        mode = BBRMode::PROBE_RTT;
+        pacing_gain = cwnd_gain = 1;
+        prior_cwnd = state->cwnd;
+        probe_rtt_done = 0;
+    }
+
+    updateMode(state, now);
+
+    uint64_t rate = pacing_gain * btl_bw;
+    if((rate != 0) && (filled_pipe || (rate > state->pacing_rate))){
+        state->pacing_rate = rate;
+    }
+}
+
+/**
+ * @brief Grow the window by the bytes acknowledged up to the target, i.e., 
+ * the bandwidth-delay product times the gain plus room for delayed and 
+ * stretched ACKs.
+ */
+void 
+BBR::onAck(CongestionState *state, unsigned int acked)
+{
+    unsigned int min_cwnd = BBR_MIN_CWND * state->mss;
+    if(mode == BBRMode::PROBE_RTT){
+        state->cwnd = std::min(state->cwnd, min_cwnd);
+        return;
+    }
+    double bdp = getBDP(cwnd_gain);
+    unsigned int target = std::max((unsigned int)bdp + 3 * state->mss, 
+                                   min_cwnd);
+    if(filled_pipe){
+        state->cwnd = std::min(state->cwnd + acked, target);
+    }
+    else if((bdp == 0) || (state->cwnd < target)){
+        state->cwnd += acked;
+    }
+    state->cwnd = std::max(state->cwnd, min_cwnd);
+}
+
+/**
+ * @brief BBR doesn't take losses for congestion. It keeps what's in flight 
+ * after a fast retransmit, and restarts from a segment after a timeout, 
+ * growing back by the bytes acknowledged.
+ */
+void 
+BBR::onLoss(CongestionState *state, LossType::LossType type)
+{
+    if(type == LossType::RTO){
+        state->cwnd = state->mss;
+    }
+    else{
+        state->cwnd = std::max(state->inflight, BBR_MIN_CWND * state->mss);
+    }
+}
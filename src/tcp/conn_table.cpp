@@ -0,0 +1,103 @@
+/**
+ * @file conn_table.cpp
+ */
+
+#include <tcp/conn_table.h>
+#include <stdint.h>
+
+bool 
+ConnKey::operator==(const ConnKey &other) const
+{
+    return (local_addr == other.local_addr) &&
+           (remote_addr == other.remote_addr) &&
+           (local_port == other.local_port) &&
+           (remote_port == other.remote_port);
+}
+
+/**
+ * @brief Fibonacci hashing of the 4-tuple. The high bits are folded into the
+ * low ones, which select the stripe and the bucket.
+ */
+size_t 
+ConnKeyHash::operator()(const ConnKey &key) const
+{
+    uint64_t addrs = ((uint64_t)key.local_addr << 32) | key.remote_addr;
+    uint64_t ports = ((uint64_t)key.local_port << 16) | key.remote_port;
+    uint64_t h = (addrs ^ (ports << 7)) * 0x9e3779b97f4a7c15ull;
+    return h ^ (h >> 32);
+}
+
+ConnKey 
+ConnTable::makeKey(TCB *tcb)
+{
+    ConnKey key;
+    key.local_addr = tcb->src_addr.s_addr;
+    key.remote_addr = tcb->dst_addr.s_addr;
+    key.local_port = tcb->src_port;
+    key.remote_port = tcb->dst_port;
+    return key;
+}
+
+ConnTable::Stripe & 
+ConnTable::getStripe(const ConnKey &key)
+{
+    return stripes[ConnKeyHash()(key) & (CONN_STRIPES - 1)];
+}
+
+/**
+ * @brief Insert TCB by its addresses and ports.
+ *
+ * @return true on success, false if the 4-tuple is already used.
+ */
+bool 
+ConnTable::insert(TCB *tcb)
+{
+    ConnKey key = makeKey(tcb);
+    Stripe &stripe = getStripe(key);
+    stripe.mutex.lock();
+    bool inserted = stripe.conns.emplace(key, tcb).second;
+    stripe.mutex.unlock();
+    return inserted;
+}
+
+/**
+ * @brief Erase TCB if it's in the table.
+ */
+void 
+ConnTable::erase(TCB *tcb)
+{
+    ConnKey key = makeKey(tcb);
+    Stripe &stripe = getStripe(key);
+    stripe.mutex.lock();
+    auto it = stripe.conns.find(key);
+    if((it != stripe.conns.end()) && (it->second == tcb)){
+        stripe.conns.erase(it);
+    }
+    stripe.mutex.unlock();
+}
+
+/**
+ * @brief Find the connection a segment belongs to.
+ *
+ * @return The TCB, or NULL if there is none. The caller releases it.
+ */
+TCB * 
+ConnTable::find(struct in_addr local_addr, u_short local_port,
+                struct in_addr remote_addr, u_short remote_port)
+{
+    ConnKey key;
+    key.local_addr = local_addr.s_addr;
+    key.remote_addr = remote_addr.s_addr;
+    key.local_port = local_port;
+    key.remote_port = remote_port;
+    Stripe &stripe = getStripe(key);
+    TCB *tcb = NULL;
+    stripe.mutex.lock();
+    auto it = stripe.conns.find(key);
+    if(it != stripe.conns.end()){
+        tcb = it->second;
+        tcb->hold();
+    }
+    stripe.mutex.unlock();
+    return tcb;
+}
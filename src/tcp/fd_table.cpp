@@ -0,0 +1,112 @@
+/**
+ * @file fd_table.cpp
+ */
+
+#include <tcp/fd_table.h>
+#include <thread>
+
+/**
+ * @brief Get the type of FD.
+ *
+ * @return FdType::NONE if it isn't a socket of the stack.
+ */
+int 
+FdTable::getType(int fd)
+{
+    if((fd < 0) || (fd >= FD_TABLE_SIZE)){
+        return FdType::NONE;
+    }
+    return entries[fd].type.load(std::memory_order_acquire);
+}
+
+/**
+ * @brief Publish a TCP socket on FD.
+ *
+ * @return true on success, false if FD is out of the table.
+ */
+bool 
+FdTable::publishTCP(int fd, TCB *tcb)
+{
+    if((fd < 0) || (fd >= FD_TABLE_SIZE)){
+        return false;
+    }
+    entries[fd].tcb.store(tcb);
+    entries[fd].type.store(FdType::TCP, std::memory_order_release);
+    return true;
+}
+
+/**
+ * @brief Publish a UDP socket on FD. Its state is found by the transport
+ * layer.
+ *
+ * @return true on success, false if FD is out of the table.
+ */
+bool 
+FdTable::publishUDP(int fd)
+{
+    if((fd < 0) || (fd >= FD_TABLE_SIZE)){
+        return false;
+    }
+    entries[fd].type.store(FdType::UDP, std::memory_order_release);
+    return true;
+}
+
+/**
+ * @brief Look up the TCB of a TCP socket. Announcing the lookup in
+ * `readers` before loading the pointer keeps `retractTCB` from returning
+ * until the reference is taken.
+ *
+ * @return The TCB, or NULL if FD isn't a TCP socket. The caller releases it.
+ */
+TCB * 
+FdTable::acquireTCB(int fd)
+{
+    if((fd < 0) || (fd >= FD_TABLE_SIZE)){
+        return NULL;
+    }
+    FdEntry &entry = entries[fd];
+    entry.readers.fetch_add(1);
+    TCB *tcb = entry.tcb.load();
+    if(tcb != NULL){
+        tcb->hold();
+    }
+    entry.readers.fetch_sub(1);
+    return tcb;
+}
+
+/**
+ * @brief Retract the TCP socket on FD, and wait for lookups of it to take
+ * their references.
+ *
+ * @return The TCB, or NULL if FD isn't a TCP socket or is being retracted
+ * by another thread.
+ */
+TCB * 
+FdTable::retractTCB(int fd)
+{
+    if((fd < 0) || (fd >= FD_TABLE_SIZE)){
+        return NULL;
+    }
+    FdEntry &entry = entries[fd];
+    TCB *tcb = entry.tcb.exchange(NULL);
+    if(tcb == NULL){
+        return NULL;
+    }
+    entry.type.store(FdType::NONE, std::memory_order_release);
+    while(entry.readers.load() != 0){
+        std::this_thread::yield();
+    }
+    return tcb;
+}
+
+/**
+ * @brief Retract the UDP socket on FD.
+ */
+void 
+FdTable::retractUDP(int fd)
+{
+    if((fd < 0) || (fd >= FD_TABLE_SIZE)){
+        return;
+    }
+    entries[fd].type.store(FdType::NONE, std::memory_order_release);
+}
@@ -0,0 +1,224 @@
+/**
+ * @file congestion.h
+ * @brief Pluggable congestion control. Each connection owns an instance of
+ * an algorithm, which keeps its own state and adjusts the congestion window
+ * in the shared `CongestionState` through hooks called on ACKs, losses and
+ * RTT samples.
+ *
+ * @see RFC5681, RFC6582 & RFC9438
+ * @see draft-cardwell-iccrg-bbr-congestion-control
+ */
+
+#pragma once
+
+#include <sys/types.h>
+#include <stdint.h>
+
+/* Algorithm of new connections */
+#define DEFAULT_CONGESTION "newreno"
+/* Maximum length of the name of an algorithm, including '\0' */
+#define CONGESTION_NAME_MAX 16
+
+/* Constants of CUBIC */
+#define CUBIC_C 0.4
+#define CUBIC_BETA 0.7
+/* HyStart: RTT samples taken at the start of a round */
+#define HYSTART_MIN_SAMPLES 8
+/* HyStart: bounds of the RTT increase(in microseconds) ending slow start */
+#define HYSTART_DELAY_MIN 4000
+#define HYSTART_DELAY_MAX 16000
+/* HyStart: maximum gap(in microseconds) between ACKs of an ACK train */
+#define HYSTART_ACK_DELTA 2000
+/* HyStart: window(in segments) below which it's off */
+#define HYSTART_LOW_WINDOW 16
+
+/* Gain of BBR to double the sending rate every round in startup, 2/ln(2) */
+#define BBR_HIGH_GAIN 2.885
+#define BBR_CWND_GAIN 2.0
+/* Rounds the bottleneck bandwidth is the maximum over */
+#define BBR_BW_ROUNDS 10
+/* Microseconds a minimum RTT is valid for before probing it again */
+#define BBR_MIN_RTT_WINDOW 10000000
+/* Microseconds to stay in PROBE_RTT */
+#define BBR_PROBE_RTT_TIME 200000
+/* Minimum window, in segments */
+#define BBR_MIN_CWND 4
+/* Number of phases in a cycle of PROBE_BW */
+#define BBR_CYCLE_LEN 8
+
+namespace LossType {
+    enum LossType {
+        FAST_RETRANSMIT, // Detected by duplicate ACKs or SACK
+        RTO,             // Retransmission timer expired
+    };
+}
+
+/**
+ * @brief Congestion state of a connection. Sizes are in bytes.
+ *
+ * @param inflight Bytes sent but not acknowledged, i.e., SND.NXT - SND.UNA.
+ * @param mss Maximum segment size the window is counted in.
+ * @param pacing_rate Bytes per second segments are paced at, 0 if they 
+ * aren't paced.
+ */
+struct CongestionState
+{
+    unsigned int cwnd;
+    unsigned int ssthresh;
+    unsigned int inflight;
+    unsigned int mss;
+    uint64_t pacing_rate;
+};
+
+/**
+ * @brief Sample of the delivery rate, taken when a segment is acknowledged 
+ * (draft-cheng-iccrg-delivery-rate-estimation).
+ *
+ * @param prior_delivered Bytes delivered when the segment was sent.
+ * @param delivered Bytes delivered since then.
+ * @param interval Microseconds it took to deliver them, the longer of the 
+ * send and ACK intervals.
+ * @param rtt RTT of the segment.
+ */
+struct RateSample
+{
+    uint64_t prior_delivered;
+    uint64_t delivered;
+    int64_t interval;
+    int64_t rtt;
+};
+
+/**
+ * @brief Interface of congestion control algorithms. Hooks are called with
+ * `conn_mutex` of the connection held.
+ */
+class CongestionControl
+{
+public:
+    virtual ~CongestionControl() = default;
+    virtual const char *getName() const = 0;
+    // The connection is established.
+    virtual void init(CongestionState *state) = 0;
+    // ACKED bytes of new data are acknowledged.
+    virtual void onAck(CongestionState *state, unsigned int acked) = 0;
+    // A segment is found lost.
+    virtual void onLoss(CongestionState *state, LossType::LossType type) = 0;
+    // RTT(in microseconds) of a segment that wasn't retransmitted.
+    virtual void onRTTSample(CongestionState *, int64_t) {}
+    // Delivery rate sampled by the same segment, before `onAck`.
+    virtual void onRateSample(CongestionState *, const RateSample *) {}
+};
+
+/**
+ * @brief Slow start and congestion avoidance of RFC5681. The window grows by
+ * the bytes acknowledged in slow start, and by one MSS per window in
+ * congestion avoidance.
+ */
+class NewReno: public CongestionControl
+{
+private:
+    unsigned int bytes_acked; // Acknowledged in congestion avoidance
+public:
+    NewReno();
+    const char *getName() const override;
+    void init(CongestionState *state) override;
+    void onAck(CongestionState *state, unsigned int acked) override;
+    void onLoss(CongestionState *state, LossType::LossType type) override;
+};
+
+/**
+ * @brief CUBIC of RFC9438. After a loss, the window grows as a cubic 
+ * function of the time since then, quickly back towards the window before 
+ * the loss, slowly around it and quickly again beyond it, so that growth 
+ * doesn't depend on the RTT. It never grows slower than a Reno sender 
+ * would. Slow start ends early by HyStart when ACK trains get as long as 
+ * half the minimum RTT, or the RTT grows within a round.
+ *
+ * Windows are counted in segments, and times in microseconds.
+ */
+class Cubic: public CongestionControl
+{
+private:
+    double w_max;        // Window before the last reduction
+    double k;            // Seconds to grow back to `w_max`
+    double origin;       // Window the cubic function is centered at
+    double w_est;        // Window a Reno sender would have
+    double growth;       // Fraction of a byte to grow the window by
+    int64_t epoch_start; // Start of congestion avoidance, 0 before it
+    int64_t min_rtt;     // 0 before any sample
+    // HyStart
+    int64_t round_start;
+    int64_t last_ack;
+    unsigned int round_acked; // Bytes acknowledged in the round
+    unsigned int round_bytes; // Bytes in flight as the round started
+    int64_t curr_rtt;    // Minimum RTT in the round, 0 before any sample
+    int64_t last_rtt;    // Minimum RTT in the last round
+    int samples;
+    void startRound(CongestionState *state, int64_t now);
+    bool hystartDone(CongestionState *state, unsigned int acked, int64_t now);
+public:
+    Cubic();
+    const char *getName() const override;
+    void init(CongestionState *state) override;
+    void onAck(CongestionState *state, unsigned int acked) override;
+    void onLoss(CongestionState *state, LossType::LossType type) override;
+    void onRTTSample(CongestionState *state, int64_t rtt) override;
+};
+
+namespace BBRMode {
+    enum BBRMode {
+        STARTUP,   // Double the rate every round until the pipe is full
+        DRAIN,     // Drain the queue built in startup
+        PROBE_BW,  // Cycle the rate around the bandwidth to probe for more
+        PROBE_RTT, // Shrink the window to drain the queue and measure RTT
+    };
+}
+
+/**
+ * @brief BBR builds a model of the path from delivery rate samples, the 
+ * maximum rate over recent rounds as the bottleneck bandwidth and the 
+ * minimum RTT as the propagation delay. It paces segments at about the 
+ * bandwidth and keeps about two bandwidth-delay products in flight, so it 
+ * neither fills buffers nor backs off on random losses.
+ *
+ * Rates are in bytes per second, and times in microseconds.
+ */
+class BBR: public CongestionControl
+{
+private:
+    BBRMode::BBRMode mode;
+    double pacing_gain;
+    double cwnd_gain;
+    // Windowed maximum of the delivery rate, one slot per round
+    double bw_samples[BBR_BW_ROUNDS];
+    uint64_t bw_rounds[BBR_BW_ROUNDS];
+    double btl_bw;
+    int64_t min_rtt;          // 0 before any sample
+    int64_t min_rtt_stamp;
+    // A round ends when a segment sent after it started is acknowledged.
+    uint64_t round_count;
+    uint64_t next_round_delivered;
+    bool round_start;
+    // The pipe is full when the bandwidth stops growing in startup.
+    double full_bw;
+    int full_bw_cnt;
+    bool filled_pipe;
+    int cycle_index;
+    int64_t cycle_stamp;
+    int64_t probe_rtt_done;   // 0 before the window is drained
+    unsigned int prior_cwnd;  // Window before PROBE_RTT
+    double getBDP(double gain);
+    void updateBandwidth(const RateSample *rs);
+    void updateMode(CongestionState *state, int64_t now);
+    void enterProbeBW(int64_t now);
+public:
+    BBR();
+    const char *getName() const override;
+    void init(CongestionState *state) override;
+    void onAck(CongestionState *state, unsigned int acked) override;
+    void onLoss(CongestionState *state, LossType::LossType type) override;
+    void onRateSample(CongestionState *state, const RateSample *rs) override;
+};
+
+unsigned int getInitialWindow(unsigned int mss);
+CongestionControl *createCongestionControl(const char *name);
@@ -0,0 +1,62 @@
+/**
+ * @file conn_table.h
+ * @brief Hash table demultiplexing segments to connections by their 4-tuple.
+ * Buckets are split into stripes, each with its own lock, so lookups of
+ * different connections rarely contend.
+ */
+
+#pragma once
+
+#include "tcb.h"
+#include <netinet/in.h>
+#include <sys/types.h>
+#include <mutex>
+#include <unordered_map>
+
+/* Number of stripes. Must be a power of 2. */
+#define CONN_STRIPES 64
+
+/**
+ * @brief Identifies a connection. Addresses and ports are in network byte
+ * order.
+ */
+struct ConnKey
+{
+    in_addr_t local_addr;
+    in_addr_t remote_addr;
+    u_short local_port;
+    u_short remote_port;
+
+    bool operator==(const ConnKey &other) const;
+};
+
+struct ConnKeyHash
+{
+    size_t operator()(const ConnKey &key) const;
+};
+
+/**
+ * @brief Connections, including those not accepted yet, keyed by their
+ * 4-tuple. A TCB is inserted once its 4-tuple is fixed and must be erased
+ * before its creator releases it. The table holds no reference, but `find`
+ * takes one before the stripe is unlocked.
+ */
+class ConnTable
+{
+private:
+    struct Stripe
+    {
+        std::mutex mutex;
+        std::unordered_map<ConnKey, TCB *, ConnKeyHash> conns;
+    };
+    Stripe stripes[CONN_STRIPES];
+    Stripe &getStripe(const ConnKey &key);
+public:
+    static ConnKey makeKey(TCB *tcb);
+    ConnTable() = default;
+    ~ConnTable() = default;
+    bool insert(TCB *tcb);
+    void erase(TCB *tcb);
+    TCB *find(struct in_addr local_addr, u_short local_port,
+              struct in_addr remote_addr, u_short remote_port);
+};
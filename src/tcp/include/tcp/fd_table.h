@@ -0,0 +1,57 @@
+/**
+ * @file fd_table.h
+ * @brief Flat table indexed by file descriptor, telling sockets of the stack
+ * from other descriptors, and TCP sockets from their TCBs, without locks.
+ *
+ * Since `read`, `write` and `close` are wrapped for the whole process, every
+ * call on a file or pipe asks the table first. That's a single load of the
+ * type of the descriptor.
+ */
+
+#pragma once
+
+#include "tcb.h"
+#include <atomic>
+
+/* Descriptors at or above it are never sockets of the stack. */
+#define FD_TABLE_SIZE 65536
+
+namespace FdType {
+    enum FdType {
+        NONE, // Not a socket of the stack
+        TCP,
+        UDP,
+    };
+}
+
+/**
+ * @brief Entry of a descriptor.
+ *
+ * @param readers Threads looking up `tcb`. A TCB is only released after it's
+ * retracted and no thread is looking it up.
+ */
+struct FdEntry
+{
+    std::atomic<int> type;
+    std::atomic<int> readers;
+    std::atomic<TCB *> tcb;
+};
+
+/**
+ * @brief Entries are published when sockets are created and retracted
+ * before their descriptors are closed, so a reused descriptor is never
+ * taken for the old socket. It's zero-initialized in static storage, so
+ * it's ready before any constructor runs.
+ */
+class FdTable
+{
+private:
+    FdEntry entries[FD_TABLE_SIZE];
+public:
+    int getType(int fd);
+    bool publishTCP(int fd, TCB *tcb);
+    bool publishUDP(int fd);
+    TCB *acquireTCB(int fd);
+    TCB *retractTCB(int fd);
+    void retractUDP(int fd);
+};
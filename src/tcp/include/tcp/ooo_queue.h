@@ -0,0 +1,41 @@
+/**
+ * @file ooo_queue.h
+ * @brief Queue of data received out of order. Data is kept as disjoint
+ * ranges of sequence numbers, so overlapping retransmissions are stored
+ * once, until the hole before them is filled. The ranges are also reported
+ * to the other end in SACK blocks.
+ *
+ * @see RFC2018
+ */
+
+#pragma once
+
+#include <sys/types.h>
+#include <map>
+#include <vector>
+
+/* Whether sequence number A is before B, modulo 2^32 */
+#define SEQ_LT(a, b) ((int)((unsigned int)(a) - (unsigned int)(b)) < 0)
+
+struct SeqLess
+{
+    bool operator()(unsigned int a, unsigned int b) const;
+};
+
+class OutOfOrderQueue
+{
+private:
+    // Data by its first sequence number
+    std::map<unsigned int, std::vector<u_char>, SeqLess> segs;
+    unsigned int bytes;
+    unsigned int last; // Sequence number of the data received last
+public:
+    OutOfOrderQueue();
+    ~OutOfOrderQueue() = default;
+    bool empty();
+    unsigned int getBytes();
+    void insert(unsigned int seq, const u_char *data, int len);
+    bool popFront(unsigned int rcv_nxt, std::vector<u_char> *data);
+    int getBlocks(unsigned int blocks[][2], int max);
+    void clear();
+};
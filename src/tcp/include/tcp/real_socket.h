@@ -31,4 +31,14 @@ int __real_close(int fildes);
 
 int __real_getaddrinfo(const char *node, const char *service,
                        const struct addrinfo *hints, struct addrinfo **res);
+
+ssize_t __real_sendto(int socket, const void *message, size_t length, 
+                      int flags, const struct sockaddr *dest_addr, 
+                      socklen_t dest_len);
+
+ssize_t __real_recvfrom(int socket, void *buffer, size_t length, int flags,
+                        struct sockaddr *address, socklen_t *address_len);
+
+int __real_setsockopt(int socket, int level, int option_name, 
+                      const void *option_value, socklen_t option_len);
 }
\ No newline at end of file
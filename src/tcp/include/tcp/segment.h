@@ -31,6 +31,7 @@
 #pragma once
 
 #include <arpa/inet.h>
+#include <stdint.h>
 
 /* TCP headers excluding options are 20 bytes. */
 #define SIZE_TCP 20
@@ -39,11 +40,39 @@
 /* Data Offset */
 #define DEFAULT_OFF (5 << 4)
 #define GET_OFF(x)  (((u_char)(x) >> 2) & ~0x3)
-/* Maximum segment length due to Ethernet II */
-#define MAX_SEG_LEN 1460
+#define SET_OFF(x)  ((u_char)((x) << 2))
+/* Options are at most 40 bytes, as Data Offset is at most 15. */
+#define MAX_OPTIONS_LEN 40
+/* Length of the MSS option */
+#define MSS_OPTION_LEN 4
+/* Length of the SACK-permitted option, and of each block of the SACK 
+ * option, which follows 2 octets of kind and length. See RFC2018. */
+#define SACK_PERM_OPTION_LEN 2
+#define SACK_BLOCK_LEN 8
+/* Blocks in a SACK option. 4 fill the 40 octets of options. */
+#define MAX_SACK_BLOCKS 4
+/* MSS assumed if the other end doesn't send the option. See RFC1122. */
+#define DEFAULT_MSS 536
 
-/* Time to retransmit a segment(in 5 milliseconds) */
-#define RETRANS_TIME 25000
+/* Interval(in milliseconds) of the retransmit timer, its granularity */
+#define RETRANS_TICK 5
+/* RTO(in microseconds) before the first RTT sample. See RFC6298. */
+#define INITIAL_RTO 1000000
+/* Bounds of RTO(in microseconds). The lower one is Linux's, as 1 second of 
+ * RFC6298 is too conservative for short paths. */
+#define MIN_RTO 200000
+#define MAX_RTO 60000000
+/* Duplicate ACKs that trigger fast retransmit. See RFC5681. */
+#define DUPACK_THRESHOLD 3
+/* Time(in microseconds) an ACK may be delayed, Linux's minimum. RFC1122 
+ * allows up to 500 milliseconds. */
+#define DELAYED_ACK_TIME 40000
+/* Worst-case delay(in microseconds) of an ACK by the other end, added to 
+ * the probe timeout when a single segment is outstanding. See RFC8985. */
+#define TLP_MAX_ACK_DELAY 200000
+/* Timeouts in a row before giving up on a connection, as Linux's 
+ * tcp_retries2 */
+#define MAX_RETRIES 15
 
 /* Segment type */
 namespace SegmentType {
@@ -62,6 +91,8 @@ namespace OptionType {
         END = 0,
         NO_OP = 1,
         MAX_SEG_SIZE = 2,
+        SACK_PERMITTED = 4,
+        SACK = 5,
     };
 }
 
@@ -92,25 +123,39 @@ struct TCPHeader
 
 /**
  * @class An object of RetransElem is an element in the retransmit queue that 
- * maintains the segment to retransmit, length of the segment, and time from 
- * the segment is first sent up to now.
+ * maintains the segment to retransmit and length of the segment.
+ * 
+ * @param end Sequence number following the segment. It's acknowledged once 
+ * SND.UNA reaches `end`.
+ * @param sent_time Time(in microseconds) it was first sent, and 
+ * `xmit_time` the time it was last sent.
+ * @param retransmitted Whether it has been retransmitted, which makes its 
+ * RTT ambiguous(Karn's algorithm).
+ * @param delivered Bytes the connection had delivered when it was sent, and 
+ * `delivered_time` and `first_sent_time` its other delivery state then, for 
+ * sampling the delivery rate as it's acknowledged.
+ * @param sacked Whether the other end has selectively acknowledged it.
+ * @param lost Whether it's deemed lost in the current recovery, and 
+ * `resent` whether it has been retransmitted since.
  */
 class RetransElem
 {
 public:
     u_char *segment;
     unsigned int seq;
+    unsigned int end;
     int len;
-    int time;
+    int64_t sent_time;
+    int64_t xmit_time;
+    bool retransmitted;
+    uint64_t delivered;
+    int64_t delivered_time;
+    int64_t first_sent_time;
+    bool sacked;
+    bool lost;
+    bool resent;
 
-    RetransElem(u_char *seg, unsigned int s, int l);
+    RetransElem(u_char *seg, unsigned int s, unsigned int e, int l, 
+                int64_t sent);
     ~RetransElem();
 };
-
-/**
- * @brief Calculate checksum of the whole segment.
- * @param segment Header address.
- * @param len Length of the segment in terms of byte.
- * @return checksum
- */
-u_short calculate_checksum(const u_char *segment, int len);
\ No newline at end of file
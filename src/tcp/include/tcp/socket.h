@@ -70,6 +70,28 @@ int __wrap_close(int fildes);
  */
 int __wrap_getaddrinfo(const char *node, const char *service,
                        const struct addrinfo *hints, struct addrinfo **res);
+
+/**
+ * @see [POSIX.1-2017: sendto]
+ * (http://pubs.opengroup.org/onlinepubs/9699919799/functions/sendto.html)
+ */
+ssize_t __wrap_sendto(int socket, const void *message, size_t length, 
+                      int flags, const struct sockaddr *dest_addr, 
+                      socklen_t dest_len);
+
+/**
+ * @see [POSIX.1-2017: recvfrom]
+ * (http://pubs.opengroup.org/onlinepubs/9699919799/functions/recvfrom.html)
+ */
+ssize_t __wrap_recvfrom(int socket, void *buffer, size_t length, int flags,
+                        struct sockaddr *address, socklen_t *address_len);
+
+/**
+ * @see [POSIX.1-2017: setsockopt]
+ * (http://pubs.opengroup.org/onlinepubs/9699919799/functions/setsockopt.html)
+ */
+int __wrap_setsockopt(int socket, int level, int option_name, 
+                      const void *option_value, socklen_t option_len);
 #ifdef __cplusplus
 }
 #endif
\ No newline at end of file
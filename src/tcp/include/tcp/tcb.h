@@ -51,10 +51,15 @@
 
 #pragma once
 
+#include <tcp/congestion.h>
+#include <tcp/ooo_queue.h>
 #include <tcp/segment.h>
+#include <tcp/timer_wheel.h>
 #include <tcp/window.h>
 #include <netinet/ip.h>
 #include <semaphore.h>
+#include <atomic>
+#include <condition_variable>
 #include <list>
 #include <mutex>
 #include <queue>
@@ -111,7 +116,6 @@ private:
     Window window;
     u_short snd_wnd;   // send window
     int max_seg;
-    int64_t getTimeMicro();
     int64_t getTimeMilli();
 public:
     SocketState::SocketState socket_state;
@@ -123,6 +127,12 @@ public:
     int backlog;
     std::list<TCB *> pending;
     std::set<TCB *> received;
+    // For connection not accepted yet. It holds a reference to the 
+    // listening socket. Protected by `conn_mutex`.
+    TCB *listener;
+    // References to the TCB. The one who creates it holds the first, and 
+    // lookups hold one while using it.
+    std::atomic<int> refs;
 
     sem_t semaphore; // Used by both listening socket and connecting socket
     sem_t fin_sem;
@@ -133,18 +143,82 @@ public:
     int reading_cnt;
     int writing_cnt;
     bool closed;
+    int error; // Error that aborted the connection, reported to the user
     ConnectionState::ConnectionState state;
+    u_char tos; // Type of Service of segments, set by IP_TOS
+    int busy_poll; // Microseconds to poll for data, set by SO_BUSY_POLL
 
-    // TODO: round-trip time (milliseconds) and variance 
-    // Set RTT to 100ms now.
+    // Smoothed round-trip time and its variance(in microseconds) of 
+    // RFC6298, 0 before the first sample. Protected by `conn_mutex`.
     int64_t srtt;
     int64_t rttvar;
     // List to retransmit
     std::list<RetransElem *> retrans_list;
     std::mutex retrans_mutex;
+    // Retransmission timer, covering the oldest segment in `retrans_list`. 
+    // It's armed while there's data outstanding and holds a reference to 
+    // the TCB meanwhile. Protected by `retrans_mutex`.
+    int64_t rto;           // Microseconds, before backing off
+    int backoff;           // Timeouts since the last RTT sample
+    TimerNode rto_timer;
+    // Congestion control. Protected by `conn_mutex`.
+    CongestionState cong;
+    CongestionControl *cc;
+    // Fast recovery of RFC6582. Protected by `conn_mutex`.
+    int dupacks;          // Duplicate ACKs in a row
+    bool in_recovery;
+    unsigned int recover; // SND.NXT as recovery started
+    // SACK(RFC2018), used if both ends sent the SACK-permitted option. 
+    // Data received out of order is held in `ooo` and reported in SACK 
+    // blocks. Protected by `conn_mutex`.
+    bool sack_ok;
+    OutOfOrderQueue ooo;
+    // Duplicate data received, reported once in the first SACK block 
+    // (D-SACK, RFC2883)
+    bool dsack_pending;
+    unsigned int dsack[2];
+    // Delayed ACKs(RFC1122 4.2.3.2). Protected by `conn_mutex`.
+    int rcv_mss;            // MSS announced to the other end
+    u_short adv_wnd;        // Window advertised last
+    int ack_bytes;          // Bytes received and not acknowledged yet
+    bool ack_queued;        // Due at the end of the receive batch
+    TimerNode ack_timer;    // Armed like `rto_timer`
+    // Scoreboard of `retrans_list`(RFC6675): bytes outstanding that are 
+    // selectively acknowledged, deemed lost, and retransmitted since. 
+    // Written with both `conn_mutex` and `retrans_mutex` held.
+    unsigned int sacked_bytes;
+    unsigned int lost_bytes;
+    unsigned int resent_bytes;
+    // RACK-TLP(RFC8985). Segments sent a reordering window before the one 
+    // delivered last are deemed lost, and when the last segments of a 
+    // flight go unacknowledged, a probe retransmits the last one to draw 
+    // an ACK before the RTO. Protected by `conn_mutex`.
+    int64_t rack_xmit_time;  // Send time of the segment delivered last
+    unsigned int rack_end;   // Sequence number following it
+    int64_t rack_rtt;        // Its RTT
+    int64_t min_rtt;         // Minimum RTT, 0 before the first sample
+    bool tlp_active;         // A probe is outstanding
+    unsigned int tlp_end;    // SND.NXT as the probe was sent
+    // Timer of RACK reordering and tail loss probes, armed like `rto_timer`. 
+    // Protected by `retrans_mutex`.
+    TimerNode loss_timer;
+    bool probe_timer;        // `loss_timer` is for a probe
+    // Notified when data is acknowledged or the window of the other end 
+    // changes. Used with `conn_mutex`.
+    std::condition_variable send_cond;
+    // Delivery state for rate samples, and the pacing timer. Protected by 
+    // `conn_mutex`.
+    uint64_t delivered;       // Bytes delivered
+    int64_t delivered_time;   // Time `delivered` was last updated
+    int64_t first_sent_time;  // Send time of the start of the flight
+    int64_t next_send_time;   // Time the next segment may be sent
 
     TCB();
     ~TCB();
+    void hold();
+    void release();
+    int64_t getTimeMicro();
+    static TimerWheel &getTimers();
     unsigned int getSequence();
     void updateSequence(unsigned int delta);
     void setSndUna(unsigned int sequence);
@@ -153,10 +227,36 @@ public:
     void setAcknowledgement(unsigned int ack);
     u_short getWindow();
     void writeWindow(const u_char *buf, int len, bool push);
+    bool queueOutOfOrder(unsigned int seq, const u_char *buf, int len);
+    bool spliceOutOfOrder();
     bool readWindow(u_char *buf, int len, ssize_t *nread);
+    bool windowUpdateDue();
     void setDestWindow(u_short window);
     u_short getDestWindow();
     void setMaxSegSize(u_short size);
     int getMaxSegSize();
-    void insertRetrans(u_char *segment, unsigned int seq, int len);
+    void insertRetrans(u_char *segment, unsigned int seq, unsigned int end, 
+                       int len);
+    void initCongestion(unsigned int mss);
+    bool setCongestion(const char *name);
+    unsigned int acknowledge(unsigned int ack);
+    unsigned int getSendWindow();
+    unsigned int getPipe();
+    bool updateScoreboard(const unsigned int blocks[][2], int n);
+    bool markLost(bool first);
+    void rackUpdate(RetransElem *e, int64_t now);
+    int64_t getPTO();
+    void armProbeTimer(int64_t now);
+    void armLossTimer(int64_t expires);
+    void cancelLossTimer();
+    void armAckTimer(int64_t expires);
+    void ackSent();
+    void markAllLost(int64_t since);
+    void discardOutstanding();
+    void updateRTT(int64_t rtt);
+    int64_t getRTO();
+    void armRetransTimer(int64_t expires);
+    void cancelRetransTimer();
+    int64_t getPaceDelay();
+    void pace(unsigned int len);
 };
@@ -7,17 +7,27 @@
 #pragma once
 
 #include "bitmap.h"
+#include "conn_table.h"
+#include "fd_table.h"
 #include "segment.h"
 #include "tcb.h"
+#include "time_wait.h"
+#include "udp.h"
 #include <ip/ip.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netdb.h>
 #include <semaphore.h>
 #include <map>
+#include <unordered_map>
+#include <vector>
 
 #define PORT_BEGIN 49152
 #define PORT_END   65536
+/* Maximum bytes sent at once on a paced connection */
+#define MAX_PACE_QUANTUM 65536
+/* Time(in microseconds) to wait before checking a backlogged device again */
+#define WRITABLE_WAIT 200
 
 class TransportLayer
 {
@@ -29,12 +39,53 @@ private:
     std::map<int, TCB *> fd2tcb;
     std::set<TCB *> tcbs;
     std::mutex tcb_mutex;
+    // Segments are demultiplexed to connections by their 4-tuple, and to 
+    // listening sockets by local port(in network byte order).
+    ConnTable conns;
+    TimeWaitTable time_wait;
+    std::unordered_map<u_short, TCB *> port2listener;
+    std::mutex listen_mutex;
     BitMap bitmap;
+    // UDP sockets, demultiplexed by local port(in network byte order).
+    std::map<int, UDPSocket *> fd2udp;
+    std::unordered_map<u_short, UDPSocket *> port2udp;
+    std::mutex udp_mutex;
+    u_short next_udp_port;
+    // Connections with an ACK due at the end of the receive batch. Each 
+    // holds a reference.
+    std::vector<TCB *> ack_queue;
+    std::mutex ack_mutex;
 
     // Private helper functions
     size_t generatePort();
+    TCB *findListener(struct in_addr addr, u_short port);
+    UDPSocket *acquireUDP(int fd);
+    void releaseUDP(UDPSocket *udp);
+    int bindUDP(UDPSocket *udp, struct in_addr addr, u_short port);
+    int closeUDP(int fd);
+    int getMaxSegSize(TCB *tcb);
+    int getAdvertisedMSS(TCB *tcb);
+    bool receiveData(TCB *tcb, unsigned int seq, const u_char *data, 
+                     int len, bool psh);
+    void delayAck(TCB *tcb, int len, bool psh);
+    void handleAckTimer(TCB *tcb);
+    void processAck(TCB *tcb, unsigned int ack_num, u_short window, 
+                    int rest_len, const unsigned int blocks[][2], int n);
+    void enterRecovery(TCB *tcb);
+    void retransmit(TCB *tcb, RetransElem *e);
+    void retransmitFirst(TCB *tcb);
+    void retransmitLost(TCB *tcb, bool force);
+    void handleLossTimer(TCB *tcb);
+    void abortConnection(TCB *tcb, int error);
+    void enterTimeWait(TCB *tcb);
+    bool handleTimeWait(SegmentType::SegmentType type, unsigned int seq, 
+                        struct in_addr local_addr, u_short local_port, 
+                        struct in_addr remote_addr, u_short remote_port);
+    bool sendTimeWaitAck(const TimeWaitEntry &entry);
 
 public:
+    // Sockets by descriptor, checked by the wrappers before the instance
+    static FdTable fds;
     NetworkLayer *network_layer;
     TransportLayer();
     ~TransportLayer();
@@ -53,6 +104,13 @@ public:
     int _close(int fildes);
     int _getaddrinfo(const char *node, const char *service,
                      const struct addrinfo *hints, struct addrinfo **res);
+    ssize_t _sendto(int socket, const void *message, size_t length, 
+                    int flags, const struct sockaddr *dest_addr, 
+                    socklen_t dest_len);
+    ssize_t _recvfrom(int socket, void *buffer, size_t length, int flags,
+                      struct sockaddr *address, socklen_t *address_len);
+    int _setsockopt(int socket, int level, int option_name, 
+                    const void *option_value, socklen_t option_len);
 
     // Send segments
     bool sendSegment(TCB *socket, SegmentType::SegmentType type, 
@@ -60,9 +118,11 @@ public:
     // Receive segments
     bool callBack(const u_char *buf, int len, 
                   struct in_addr src_addr, struct in_addr dst_addr);
+    void flushAcks();
+    // Receive datagrams
+    bool udpCallBack(const u_char *buf, int len, 
+                     struct in_addr src_addr, struct in_addr dst_addr);
 
-    // Timed wait thread
-    void timedWait(TCB *tcb);
-    // Retransmission
+    // Retransmission and TIME-WAIT
     void updateRetrans();
 };
\ No newline at end of file
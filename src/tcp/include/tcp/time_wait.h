@@ -0,0 +1,57 @@
+/**
+ * @file time_wait.h
+ * @brief Connections in TIME-WAIT. As a connection enters it, its TCB is
+ * released, and only what's needed to answer a retransmitted FIN and to
+ * keep the 4-tuple from being reused too early is kept here. Entries are
+ * aged by a timing wheel, so there's no thread per connection.
+ *
+ * @see RFC793, RFC1122 4.2.2.13 & RFC1337
+ */
+
+#pragma once
+
+#include "conn_table.h"
+#include "timer_wheel.h"
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+/* Length of TIME-WAIT(in microseconds). It's far shorter than 2 MSL, as
+ * segments don't live long on the emulated networks, but outlasts the RTO
+ * of the other end, so that its retransmitted FIN is answered. */
+#define TIME_WAIT_TIME 1000000
+
+/**
+ * @brief A connection in TIME-WAIT.
+ *
+ * @param snd_nxt Sequence number to acknowledge a FIN with.
+ * @param rcv_nxt Sequence number following the FIN of the other end. A new
+ * SYN above it may reuse the 4-tuple.
+ */
+struct TimeWaitEntry
+{
+    ConnKey key;
+    unsigned int snd_nxt;
+    unsigned int rcv_nxt;
+    u_char tos;
+    TimerNode timer;
+};
+
+class TimeWaitTable
+{
+private:
+    std::mutex mutex;
+    std::unordered_map<ConnKey, TimeWaitEntry *, ConnKeyHash> entries;
+    TimerWheel timers;
+    void remove(TimeWaitEntry *entry);
+public:
+    TimeWaitTable();
+    ~TimeWaitTable();
+    void insert(TCB *tcb, int64_t expires);
+    bool find(struct in_addr local_addr, u_short local_port,
+              struct in_addr remote_addr, u_short remote_port,
+              TimeWaitEntry *entry);
+    bool erase(const ConnKey &key);
+    void restart(const ConnKey &key, int64_t expires);
+    void expire(int64_t now, std::vector<ConnKey> &expired);
+};
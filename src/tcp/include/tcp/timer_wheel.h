@@ -0,0 +1,63 @@
+/**
+ * @file timer_wheel.h
+ * @brief Hierarchical timing wheel. Timers are intrusive nodes hashed into
+ * slots by their expiry time, so arming and cancelling one is O(1), and
+ * advancing the wheel only touches the slots it passes and the timers in
+ * them. Timers too far away for the lowest level wait in a coarser one and
+ * are cascaded down as their time gets near.
+ *
+ * @see Varghese & Lauck, "Hashed and Hierarchical Timing Wheels"
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <mutex>
+#include <vector>
+
+/* Bits of the slot index in a level */
+#define WHEEL_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+#define WHEEL_MASK (WHEEL_SLOTS - 1)
+/* Number of levels. They span 2^24 ticks, about a day in 5 milliseconds. */
+#define WHEEL_LEVELS 4
+
+/**
+ * @brief A timer, embedded in the object it times.
+ *
+ * @param owner The object, for the one handling the expired timer.
+ * @param expires Tick it expires at.
+ */
+struct TimerNode
+{
+    TimerNode *prev;
+    TimerNode *next; // NULL if it isn't armed
+    int64_t expires;
+    void *owner;
+
+    TimerNode(void *o = NULL);
+};
+
+/**
+ * @brief Thread-safe timing wheel. Expired timers are taken off the wheel
+ * and returned to the caller of `advance`, who handles them without holding
+ * the lock of the wheel, so handlers are free to arm timers again.
+ */
+class TimerWheel
+{
+private:
+    int64_t tick_us;  // Microseconds per tick
+    int64_t current;  // Next tick to be processed
+    TimerNode slots[WHEEL_LEVELS][WHEEL_SLOTS]; // Heads of circular lists
+    std::mutex mutex;
+    void place(TimerNode *node);
+    void unlink(TimerNode *node);
+    void cascade(int level, int index);
+public:
+    TimerWheel(int64_t tick);
+    ~TimerWheel() = default;
+    bool arm(TimerNode *node, int64_t expires);
+    bool cancel(TimerNode *node);
+    bool isArmed(TimerNode *node);
+    void advance(int64_t now, std::vector<TimerNode *> &expired);
+};
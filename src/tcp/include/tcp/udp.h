@@ -0,0 +1,111 @@
+/**
+ * @file udp.h
+ *
+ * @brief Utilities for UDP datagram sockets.
+ *
+ *  0      7 8     15 16    23 24    31
+ * +--------+--------+--------+--------+
+ * |     Source      |   Destination   |
+ * |      Port       |      Port       |
+ * +--------+--------+--------+--------+
+ * |                 |                 |
+ * |     Length      |    Checksum     |
+ * +--------+--------+--------+--------+
+ * |
+ * |          data octets ...
+ * +---------------- ...
+ *
+ *      User Datagram Header Format
+ */
+
+#pragma once
+
+#include <netinet/in.h>
+#include <semaphore.h>
+#include <sys/types.h>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+/* UDP headers are 8 bytes. */
+#define SIZE_UDP 8
+/* Maximum length of data in a datagram: 65535 - 20(IP) - 8(UDP) */
+#define MAX_UDP_DATA 65507
+/* Number of datagrams queued on a socket. Must be a power of 2. */
+#define UDP_QUEUE_LEN 256
+
+/* UDP header */
+struct UDPHeader
+{
+    u_short src_port;
+    u_short dst_port;
+    u_short length;
+    u_short checksum;
+};
+
+/**
+ * @brief A datagram received. Its buffer is reused by later datagrams, so
+ * it's only allocated when a longer one arrives.
+ */
+struct UDPDatagram
+{
+    struct in_addr src_addr;
+    u_short src_port;
+    int len;
+    std::vector<u_char> data;
+};
+
+/**
+ * @brief Ring of received datagrams. There is only one producer at a time,
+ * the receive path under `EpollServer::rx_mutex`, and readers of a socket
+ * are serialized by its `recv_mutex`, so the indices alone synchronize the
+ * ring without locks.
+ */
+class UDPQueue
+{
+private:
+    UDPDatagram slots[UDP_QUEUE_LEN];
+    std::atomic<unsigned int> head; // Next slot to read
+    std::atomic<unsigned int> tail; // Next slot to write
+public:
+    UDPQueue();
+    ~UDPQueue() = default;
+    bool push(const u_char *buf, int len, struct in_addr src_addr,
+              u_short src_port);
+    UDPDatagram *front();
+    void pop();
+};
+
+/**
+ * @brief A UDP socket. Ports and addresses are in network byte order.
+ *
+ * @param bound Whether it has a local port.
+ * @param connected Whether `dst_addr` and `dst_port` are the default
+ * destination, set by `connect`.
+ * @param semaphore Number of datagrams in the queue. Also posted on close to
+ * wake up readers.
+ * @param users Number of threads using the socket. The last one deletes it
+ * if it's closed. Protected by `udp_mutex` of the transport layer.
+ */
+class UDPSocket
+{
+public:
+    struct in_addr src_addr;
+    u_short src_port;
+    struct in_addr dst_addr;
+    u_short dst_port;
+    bool bound;
+    bool connected;
+    bool closed;
+    u_char tos; // Type of Service of datagrams, set by IP_TOS
+    int busy_poll; // Microseconds to poll for data, set by SO_BUSY_POLL
+    int users;
+    std::mutex bind_mutex;
+    std::mutex recv_mutex;
+    sem_t semaphore;
+    std::atomic<unsigned int> drops; // Datagrams dropped since queue's full
+    UDPQueue queue;
+
+    UDPSocket();
+    ~UDPSocket();
+};
@@ -0,0 +1,146 @@
+/**
+ * @file ooo_queue.cpp
+ */
+
+#include <tcp/ooo_queue.h>
+
+bool 
+SeqLess::operator()(unsigned int a, unsigned int b) const
+{
+    return SEQ_LT(a, b);
+}
+
+OutOfOrderQueue::OutOfOrderQueue(): segs(), bytes(0), last(0) {}
+
+bool 
+OutOfOrderQueue::empty()
+{
+    return segs.empty();
+}
+
+/**
+ * @brief Get the number of bytes held.
+ */
+unsigned int 
+OutOfOrderQueue::getBytes()
+{
+    return bytes;
+}
+
+/**
+ * @brief Hold LEN bytes of DATA starting at sequence number SEQ. Only the
+ * parts not held yet are copied.
+ */
+void 
+OutOfOrderQueue::insert(unsigned int seq, const u_char *data, int len)
+{
+    unsigned int end = seq + len;
+    unsigned int cur = seq;
+    last = seq;
+    // Start from the range beginning at or before SEQ.
+    auto it = segs.upper_bound(seq);
+    if(it != segs.begin()){
+        it--;
+    }
+    while(SEQ_LT(cur, end)){
+        unsigned int next = end;
+        if(it != segs.end()){
+            unsigned int s = it->first;
+            unsigned int e = s + it->second.size();
+            if(!SEQ_LT(cur, s)){
+                // CUR is inside or after this range.
+                if(SEQ_LT(cur, e)){
+                    cur = e;
+                }
+                it++;
+                continue;
+            }
+            if(SEQ_LT(s, end)){
+                next = s;
+            }
+        }
+        const u_char *p = data + (cur - seq);
+        segs.emplace_hint(it, cur, std::vector<u_char>(p, p + (next - cur)));
+        bytes += next - cur;
+        cur = next;
+    }
+}
+
+/**
+ * @brief Take the data at RCV_NXT, if it's held. Data before RCV_NXT is
+ * dropped.
+ *
+ * @param data Set to the data following RCV_NXT in the first range.
+ * @return true if there's data at RCV_NXT.
+ */
+bool 
+OutOfOrderQueue::popFront(unsigned int rcv_nxt, std::vector<u_char> *data)
+{
+    while(!segs.empty()){
+        auto it = segs.begin();
+        unsigned int s = it->first;
+        unsigned int e = s + it->second.size();
+        if(SEQ_LT(rcv_nxt, s)){
+            return false;
+        }
+        bytes -= it->second.size();
+        if(SEQ_LT(rcv_nxt, e)){
+            data->assign(it->second.begin() + (rcv_nxt - s),
+                         it->second.end());
+            segs.erase(it);
+            return true;
+        }
+        segs.erase(it);
+    }
+    return false;
+}
+
+/**
+ * @brief Get at most MAX ranges of contiguous data held, as SACK blocks.
+ * The first one holds the data received last.
+ *
+ * @return Number of blocks.
+ */
+int 
+OutOfOrderQueue::getBlocks(unsigned int blocks[][2], int max)
+{
+    std::vector<std::pair<unsigned int, unsigned int>> ranges;
+    for(auto &i: segs){
+        unsigned int s = i.first;
+        unsigned int e = s + i.second.size();
+        if(!ranges.empty() && (ranges.back().second == s)){
+            ranges.back().second = e;
+        }
+        else{
+            ranges.emplace_back(s, e);
+        }
+    }
+    int n = 0;
+    for(auto &r: ranges){
+        if(!SEQ_LT(last, r.first) && SEQ_LT(last, r.second)){
+            blocks[n][0] = r.first;
+            blocks[n][1] = r.second;
+            n++;
+            break;
+        }
+    }
+    for(auto &r: ranges){
+        if(n == max){
+            break;
+        }
+        if((n != 0) && (blocks[0][0] == r.first)){
+            continue;
+        }
+        blocks[n][0] = r.first;
+        blocks[n][1] = r.second;
+        n++;
+    }
+    return n;
+}
+
+void 
+OutOfOrderQueue::clear()
+{
+    segs.clear();
+    bytes = 0;
+}
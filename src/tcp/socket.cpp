@@ -2,9 +2,15 @@
  * @file socket.cpp
  */
 
+#include <tcp/real_socket.h>
 #include <tcp/socket.h>
 #include <tcp/tcp.h>
 
+/* Whether FD is a socket of the stack. Other descriptors are passed through 
+ * to the libc functions without touching the transport layer. */
+#define IS_STACK_FD(fd) \
+    (TransportLayer::fds.getType(fd) != FdType::NONE)
+
 int __wrap_socket(int domain, int type, int protocol)
 {
     return TransportLayer::getInstance()._socket(domain, type, protocol);
@@ -13,38 +19,59 @@ int __wrap_socket(int domain, int type, int protocol)
 int __wrap_bind(int socket, const struct sockaddr *address,
                 socklen_t address_len)
 {
+    if(!IS_STACK_FD(socket)){
+        return __real_bind(socket, address, address_len);
+    }
     return TransportLayer::getInstance()._bind(socket, address, address_len);
 }
 
 int __wrap_listen(int socket, int backlog)
 {
+    if(!IS_STACK_FD(socket)){
+        return __real_listen(socket, backlog);
+    }
     return TransportLayer::getInstance()._listen(socket, backlog);
 }
 
 int __wrap_connect(int socket, const struct sockaddr *address,
                    socklen_t address_len)
 {
+    if(!IS_STACK_FD(socket)){
+        return __real_connect(socket, address, address_len);
+    }
     return TransportLayer::getInstance()._connect(socket, address, address_len);
 }
 
 int __wrap_accept(int socket, struct sockaddr *address, 
                   socklen_t *address_len)
 {
+    if(!IS_STACK_FD(socket)){
+        return __real_accept(socket, address, address_len);
+    }
     return TransportLayer::getInstance()._accept(socket, address, address_len);
 }
 
 ssize_t __wrap_read(int fildes, void *buf, size_t nbyte)
 {
+    if(!IS_STACK_FD(fildes)){
+        return __real_read(fildes, buf, nbyte);
+    }
     return TransportLayer::getInstance()._read(fildes, buf, nbyte);
 }
 
 ssize_t __wrap_write(int fildes, const void *buf, size_t nbyte)
 {
+    if(!IS_STACK_FD(fildes)){
+        return __real_write(fildes, buf, nbyte);
+    }
     return TransportLayer::getInstance()._write(fildes, buf, nbyte);
 }
 
 int __wrap_close(int fildes)
 {
+    if(!IS_STACK_FD(fildes)){
+        return __real_close(fildes);
+    }
     return TransportLayer::getInstance()._close(fildes);
 }
 
@@ -53,4 +80,41 @@ int __wrap_getaddrinfo(const char *node, const char *service,
 {
     return TransportLayer::getInstance()._getaddrinfo(node, service, 
                                                       hints, res);
+}
+
+ssize_t __wrap_sendto(int socket, const void *message, size_t length, 
+                      int flags, const struct sockaddr *dest_addr, 
+                      socklen_t dest_len)
+{
+    if(!IS_STACK_FD(socket)){
+        return __real_sendto(socket, message, length, flags, dest_addr, 
+                             dest_len);
+    }
+    return TransportLayer::getInstance()._sendto(socket, message, length, 
+                                                 flags, dest_addr, dest_len);
+}
+
+ssize_t __wrap_recvfrom(int socket, void *buffer, size_t length, int flags,
+                        struct sockaddr *address, socklen_t *address_len)
+{
+    if(!IS_STACK_FD(socket)){
+        return __real_recvfrom(socket, buffer, length, flags, address, 
+                               address_len);
+    }
+    return TransportLayer::getInstance()._recvfrom(socket, buffer, length, 
+                                                   flags, address, 
+                                                   address_len);
+}
+
+int __wrap_setsockopt(int socket, int level, int option_name, 
+                      const void *option_value, socklen_t option_len)
+{
+    if(!IS_STACK_FD(socket)){
+        return __real_setsockopt(socket, level, option_name, option_value, 
+                                 option_len);
+    }
+    return TransportLayer::getInstance()._setsockopt(socket, level, 
+                                                     option_name, 
+                                                     option_value, 
+                                                     option_len);
 }
\ No newline at end of file
@@ -4,12 +4,24 @@
 
 #include <tcp/tcb.h>
 #include <string.h>
+#include <algorithm>
 #include <chrono>
 
 TCB::TCB(): 
-    seq_init(false), window(), pending(), accepting_cnt(0), max_seg(-1),
-    reading_cnt(0), writing_cnt(0), closed(false), srtt(100), rttvar(0),
-    socket_state(SocketState::UNSPECIFIED), state(ConnectionState::CLOSED)
+    seq_init(false), window(), max_seg(-1), 
+    socket_state(SocketState::UNSPECIFIED), pending(), listener(NULL), 
+    refs(1), accepting_cnt(0), reading_cnt(0), writing_cnt(0), 
+    closed(false), error(0), state(ConnectionState::CLOSED), tos(0), 
+    busy_poll(0), srtt(0), rttvar(0), 
+    rto(INITIAL_RTO), backoff(0), rto_timer(this), cong(), 
+    cc(createCongestionControl(DEFAULT_CONGESTION)), dupacks(0), 
+    in_recovery(false), recover(0), sack_ok(false), ooo(), 
+    dsack_pending(false), rcv_mss(DEFAULT_MSS), adv_wnd(0), ack_bytes(0), 
+    ack_queued(false), ack_timer(this), sacked_bytes(0), lost_bytes(0), 
+    resent_bytes(0), rack_xmit_time(0), rack_end(0), 
+    rack_rtt(0), min_rtt(0), tlp_active(false), tlp_end(0), 
+    loss_timer(this), probe_timer(false), delivered(0), 
+    delivered_time(0), first_sent_time(0), next_send_time(0)
 {
     sem_init(&semaphore, 0, 0);
     sem_init(&fin_sem, 0, 0);
@@ -26,19 +38,40 @@ TCB::~TCB()
         delete e;
     }
     retrans_mutex.unlock();
+    delete cc;
 
     for(auto it: received){
-        delete it;
+        it->release();
     }
     pending_mutex.lock();
     while(!pending.empty()){
         auto it = pending.front();
-        delete it;
+        it->release();
         pending.pop_front();
     }
     pending_mutex.unlock();
 }
 
+/**
+ * @brief Take a reference to the TCB, which keeps it from being deleted.
+ */
+void 
+TCB::hold()
+{
+    refs.fetch_add(1, std::memory_order_relaxed);
+}
+
+/**
+ * @brief Drop a reference to the TCB. The last one deletes it.
+ */
+void 
+TCB::release()
+{
+    if(refs.fetch_sub(1, std::memory_order_acq_rel) == 1){
+        delete this;
+    }
+}
+
 /**
  * @brief Obtain time in microseconds.
  */
@@ -88,6 +121,7 @@ void
 TCB::updateSequence(unsigned int delta)
 {
     snd_nxt += delta;
+    cong.inflight = snd_nxt - snd_una;
 }
 
 /**
@@ -97,6 +131,7 @@ void
 TCB::setSndUna(unsigned int sequence)
 {
     snd_una = sequence;
+    cong.inflight = snd_nxt - snd_una;
 }
 
 unsigned int 
@@ -153,6 +188,46 @@ TCB::writeWindow(const u_char *buf, int len, bool push)
     window.mutex.unlock();
 }
 
+/**
+ * @brief Hold LEN bytes of BUF received out of order at sequence number SEQ, 
+ * after RCV.NXT, until the hole before them is filled. Data beyond the 
+ * window is dropped, so that all the data held fits in the window once 
+ * the hole is filled. The caller holds `conn_mutex`.
+ * 
+ * @return Whether any data is held.
+ */
+bool 
+TCB::queueOutOfOrder(unsigned int seq, const u_char *buf, int len)
+{
+    unsigned int wnd = getWindow();
+    if((len <= 0) || !SEQ_LT(rcv_nxt, seq) || (seq - rcv_nxt >= wnd)){
+        return false;
+    }
+    len = std::min((unsigned int)len, wnd - (seq - rcv_nxt));
+    ooo.insert(seq, buf, len);
+    return true;
+}
+
+/**
+ * @brief Move the data held out of order that now follows RCV.NXT into the 
+ * window. It's pushed, having waited for the hole already. The caller holds 
+ * `conn_mutex`.
+ * 
+ * @return Whether any data is moved.
+ */
+bool 
+TCB::spliceOutOfOrder()
+{
+    std::vector<u_char> data;
+    bool spliced = false;
+    while(ooo.popFront(rcv_nxt, &data)){
+        writeWindow(data.data(), data.size(), true);
+        rcv_nxt += data.size();
+        spliced = true;
+    }
+    return spliced;
+}
+
 /**
  * @brief Read LEN bytes from window to BUF.
  * 
@@ -191,6 +266,20 @@ TCB::readWindow(u_char *buf, int len, ssize_t *nread)
     return false;
 }
 
+/**
+ * @brief Whether the window has opened enough since it was last advertised 
+ * to be worth an update, i.e., by a segment or half the buffer. Smaller 
+ * updates would only invite small segments(receiver-side SWS avoidance).
+ * 
+ * @see RFC1122 4.2.3.3
+ */
+bool 
+TCB::windowUpdateDue()
+{
+    int opened = (int)getWindow() - (int)adv_wnd;
+    return opened >= std::min(rcv_mss, (int)window.n / 2);
+}
+
 /**
  * @brief Set window size of the other end.
  */
@@ -226,11 +315,583 @@ TCB::getMaxSegSize()
  * retransmit list waiting for ack or timeout.
  */
 void 
-TCB::insertRetrans(u_char *segment, unsigned int seq, int len)
+TCB::insertRetrans(u_char *segment, unsigned int seq, unsigned int end, 
+                   int len)
 {
-    RetransElem *e = new RetransElem(segment, seq, len);
+    int64_t now = getTimeMicro();
+    RetransElem *e = new RetransElem(segment, seq, end, len, now);
     retrans_mutex.lock();
+    // A new flight starts when nothing is outstanding, and so does the 
+    // retransmission timer.
+    if(retrans_list.empty()){
+        first_sent_time = delivered_time = now;
+        armRetransTimer(now + getRTO());
+    }
+    e->delivered = delivered;
+    e->delivered_time = delivered_time;
+    e->first_sent_time = first_sent_time;
     retrans_list.push_back(e);
+    armProbeTimer(now);
     retrans_mutex.unlock();
     return;
+}
+
+/**
+ * @brief Start congestion control once the connection is established.
+ * 
+ * @param mss Maximum length of data in a segment sent.
+ */
+void 
+TCB::initCongestion(unsigned int mss)
+{
+    cong.mss = mss;
+    cong.inflight = snd_nxt - snd_una;
+    cc->init(&cong);
+    // Any ACK of new data may start recovery.
+    recover = snd_una - 1;
+}
+
+/**
+ * @brief Switch to the congestion control algorithm NAME. On an established 
+ * connection, the new algorithm takes over the current window. The caller 
+ * holds `conn_mutex`.
+ * 
+ * @return false if there's no such algorithm.
+ */
+bool 
+TCB::setCongestion(const char *name)
+{
+    CongestionControl *new_cc = createCongestionControl(name);
+    if(new_cc == NULL){
+        return false;
+    }
+    delete cc;
+    cc = new_cc;
+    cong.pacing_rate = 0;
+    if(cong.mss != 0){
+        unsigned int cwnd = cong.cwnd, ssthresh = cong.ssthresh;
+        cc->init(&cong);
+        cong.cwnd = cwnd;
+        cong.ssthresh = ssthresh;
+    }
+    return true;
+}
+
+/**
+ * @brief Process the acknowledgement number ACK of a segment received. 
+ * Segments acknowledged are removed from the retransmit list, and the RTT 
+ * of the last one is sampled unless any of them has been retransmitted, as 
+ * the ACK may have been held back by the lost one. The congestion control 
+ * is told about both. In fast recovery, the window is deflated instead of 
+ * grown.
+ * 
+ * @return Number of bytes newly acknowledged.
+ */
+unsigned int 
+TCB::acknowledge(unsigned int ack)
+{
+    if(!seq_init || ((int)(ack - snd_una) <= 0) || 
+       ((int)(ack - snd_nxt) > 0))
+    {
+        return 0;
+    }
+    unsigned int acked = ack - snd_una;
+    snd_una = ack;
+    cong.inflight = snd_nxt - snd_una;
+
+    int64_t now = getTimeMicro();
+    int64_t rtt = -1;
+    bool retrans_acked = false;
+    RateSample rs = {0, 0, 0, -1};
+    delivered += acked;
+    delivered_time = now;
+    retrans_mutex.lock();
+    while(!retrans_list.empty()){
+        RetransElem *e = retrans_list.front();
+        if((int)(e->end - ack) > 0){
+            break;
+        }
+        retrans_acked |= e->retransmitted;
+        rtt = retrans_acked ? -1 : now - e->sent_time;
+        if(!e->retransmitted){
+            rs.prior_delivered = e->delivered;
+            rs.delivered = delivered - e->delivered;
+            rs.interval = std::max(e->sent_time - e->first_sent_time, 
+                                   now - e->delivered_time);
+            rs.rtt = rtt;
+            first_sent_time = e->sent_time;
+        }
+        if(e->sacked){
+            sacked_bytes -= e->end - e->seq;
+        }
+        else{
+            rackUpdate(e, now);
+        }
+        if(e->lost){
+            lost_bytes -= e->end - e->seq;
+        }
+        if(e->resent){
+            resent_bytes -= e->end - e->seq;
+        }
+        delete e;
+        retrans_list.pop_front();
+    }
+    if(rtt >= 0){
+        updateRTT(rtt);
+    }
+    // Restart the timer for the data left(RFC6298 5.3).
+    if(retrans_list.empty()){
+        cancelRetransTimer();
+        cancelLossTimer();
+    }
+    else{
+        armRetransTimer(now + getRTO());
+    }
+    retrans_mutex.unlock();
+
+    if(rtt >= 0){
+        cc->onRTTSample(&cong, rtt);
+    }
+    if(rs.interval > 0){
+        cc->onRateSample(&cong, &rs);
+    }
+    if(!in_recovery){
+        cc->onAck(&cong, acked);
+    }
+    else if((int)(ack - recover) >= 0){
+        // Full ACK. Deflate the window(RFC6582 3.2 step 3).
+        in_recovery = false;
+        cong.cwnd = std::min(cong.ssthresh, 
+                             std::max(cong.inflight, cong.mss) + cong.mss);
+    }
+    else if(!sack_ok){
+        // Partial ACK. Deflate the window by the data acknowledged, and add 
+        // back one MSS for the segment to be retransmitted. With SACK, the 
+        // pipe is counted instead.
+        cong.cwnd -= std::min(acked, cong.cwnd);
+        if(acked >= cong.mss){
+            cong.cwnd += cong.mss;
+        }
+    }
+    retrans_mutex.lock();
+    armProbeTimer(now);
+    retrans_mutex.unlock();
+    send_cond.notify_all();
+    return acked;
+}
+
+/**
+ * @brief Update SRTT, RTTVAR and RTO with the sample RTT, which must not 
+ * come from a retransmitted segment(Karn's algorithm). It ends the backoff 
+ * of the timer. The caller holds `conn_mutex` and `retrans_mutex`.
+ * 
+ * @see RFC6298 2
+ */
+void 
+TCB::updateRTT(int64_t rtt)
+{
+    if(srtt == 0){
+        srtt = rtt;
+        rttvar = rtt / 2;
+    }
+    else{
+        int64_t delta = srtt > rtt ? srtt - rtt : rtt - srtt;
+        rttvar = (3 * rttvar + delta) / 4;
+        srtt = (7 * srtt + rtt) / 8;
+    }
+    rto = srtt + std::max((int64_t)RETRANS_TICK * 1000, 4 * rttvar);
+    rto = std::min(std::max(rto, (int64_t)MIN_RTO), (int64_t)MAX_RTO);
+    backoff = 0;
+}
+
+/**
+ * @brief Get the timeout of the retransmission timer, doubled on each 
+ * timeout since the last RTT sample. The caller holds `retrans_mutex`.
+ * 
+ * @see RFC6298 5.5
+ */
+int64_t 
+TCB::getRTO()
+{
+    int64_t timeout = rto;
+    for(int i = 0; (i < backoff) && (timeout < MAX_RTO); i++){
+        timeout *= 2;
+    }
+    return std::min(timeout, (int64_t)MAX_RTO);
+}
+
+/**
+ * @brief Get the wheel of retransmission timers of all connections. It's 
+ * created on first use, as sockets may be used before static constructors 
+ * of this file run.
+ */
+TimerWheel & 
+TCB::getTimers()
+{
+    static TimerWheel timers(RETRANS_TICK * 1000);
+    return timers;
+}
+
+/**
+ * @brief Arm or re-arm the retransmission timer to expire at EXPIRES(in 
+ * microseconds). The caller holds `retrans_mutex`.
+ */
+void 
+TCB::armRetransTimer(int64_t expires)
+{
+    if(!getTimers().arm(&rto_timer, expires)){
+        hold();
+    }
+}
+
+/**
+ * @brief Cancel the retransmission timer. The caller holds `retrans_mutex` 
+ * and a reference to the TCB.
+ */
+void 
+TCB::cancelRetransTimer()
+{
+    if(getTimers().cancel(&rto_timer)){
+        release();
+    }
+}
+
+/**
+ * @brief Get the microseconds until the pacing timer allows the next 
+ * segment.
+ */
+int64_t 
+TCB::getPaceDelay()
+{
+    if(cong.pacing_rate == 0){
+        return 0;
+    }
+    int64_t delay = next_send_time - getTimeMicro();
+    return delay > 0 ? delay : 0;
+}
+
+/**
+ * @brief Advance the pacing timer over LEN bytes just sent.
+ */
+void 
+TCB::pace(unsigned int len)
+{
+    if(cong.pacing_rate == 0){
+        return;
+    }
+    int64_t now = getTimeMicro();
+    next_send_time = std::max(next_send_time, now) + 
+                     (int64_t)(len * 1000000ull / cong.pacing_rate);
+}
+
+/**
+ * @brief Arm `ack_timer` to expire at EXPIRES(in microseconds), unless it's 
+ * armed already for an earlier segment. The caller holds `conn_mutex`.
+ */
+void 
+TCB::armAckTimer(int64_t expires)
+{
+    if(!getTimers().isArmed(&ack_timer)){
+        getTimers().arm(&ack_timer, expires);
+        hold();
+    }
+}
+
+/**
+ * @brief Note that a segment acknowledging all data received has been sent, 
+ * so no delayed ACK is due. The caller holds `conn_mutex` and a reference 
+ * to the TCB.
+ */
+void 
+TCB::ackSent()
+{
+    ack_bytes = 0;
+    if(getTimers().cancel(&ack_timer)){
+        release();
+    }
+}
+
+/**
+ * @brief Drop the data outstanding and stop the timers, as the connection 
+ * ends. The caller holds `conn_mutex` and a reference to the TCB.
+ */
+void 
+TCB::discardOutstanding()
+{
+    retrans_mutex.lock();
+    for(auto e: retrans_list){
+        delete e;
+    }
+    retrans_list.clear();
+    sacked_bytes = lost_bytes = resent_bytes = 0;
+    cancelRetransTimer();
+    cancelLossTimer();
+    retrans_mutex.unlock();
+    ackSent();
+    setSndUna(snd_nxt);
+    in_recovery = false;
+    tlp_active = false;
+}
+
+/**
+ * @brief Get the number of bytes that may be sent now, i.e., the smaller of 
+ * the congestion window and the window of the other end, less the bytes in 
+ * the network.
+ */
+unsigned int 
+TCB::getSendWindow()
+{
+    unsigned int wnd = std::min(cong.cwnd, (unsigned int)snd_wnd);
+    unsigned int pipe = getPipe();
+    return wnd > pipe ? wnd - pipe : 0;
+}
+
+/**
+ * @brief Get the bytes deemed in the network: those outstanding, less those 
+ * selectively acknowledged or lost, plus those retransmitted. Without SACK, 
+ * it's all outstanding. The caller holds `conn_mutex`.
+ * 
+ * @see RFC6675 4
+ */
+unsigned int 
+TCB::getPipe()
+{
+    unsigned int left = sacked_bytes + lost_bytes;
+    unsigned int pipe = cong.inflight > left ? cong.inflight - left : 0;
+    return pipe + resent_bytes;
+}
+
+/**
+ * @brief Mark the segments outstanding that are covered by the N SACK 
+ * BLOCKS received. A segment deemed lost is no longer once it's sacked. 
+ * The caller holds `conn_mutex`.
+ * 
+ * @return Whether any segment is newly sacked.
+ */
+bool 
+TCB::updateScoreboard(const unsigned int blocks[][2], int n)
+{
+    bool updated = false;
+    int64_t now = getTimeMicro();
+    retrans_mutex.lock();
+    for(int i = 0; i < n; i++){
+        unsigned int left = blocks[i][0], right = blocks[i][1];
+        // Blocks must lie within the data outstanding. Others, such as 
+        // D-SACK blocks, are ignored.
+        if(!SEQ_LT(left, right) || SEQ_LT(left, snd_una) || 
+           SEQ_LT(snd_nxt, right))
+        {
+            continue;
+        }
+        for(auto e: retrans_list){
+            if(!SEQ_LT(e->seq, right)){
+                break;
+            }
+            if(e->sacked || SEQ_LT(e->seq, left) || SEQ_LT(right, e->end)){
+                continue;
+            }
+            e->sacked = true;
+            sacked_bytes += e->end - e->seq;
+            rackUpdate(e, now);
+            if(e->lost){
+                e->lost = false;
+                lost_bytes -= e->end - e->seq;
+            }
+            if(e->resent){
+                e->resent = false;
+                resent_bytes -= e->end - e->seq;
+            }
+            updated = true;
+        }
+    }
+    retrans_mutex.unlock();
+    return updated;
+}
+
+/**
+ * @brief Mark the segments outstanding that are deemed lost, i.e., those 
+ * not sacked with at least `DUPACK_THRESHOLD` segments sacked after them, 
+ * those sent a reordering window before the segment delivered last(RACK), 
+ * and the first one if FIRST. A retransmission is deemed lost by RACK as 
+ * well. If a segment may be deemed lost later, `loss_timer` is armed to 
+ * check again. The caller holds `conn_mutex`.
+ * 
+ * @return Whether any segment is newly marked.
+ * 
+ * @see RFC6675 4 & RFC8985 6.2
+ */
+bool 
+TCB::markLost(bool first)
+{
+    bool marked = false;
+    int sacked_after = 0;
+    int64_t now = getTimeMicro();
+    // A quarter of the minimum RTT tolerates mild reordering.
+    int64_t reo_wnd = std::min(min_rtt / 4, srtt);
+    int64_t wait = 0;
+    retrans_mutex.lock();
+    for(auto it = retrans_list.rbegin(); it != retrans_list.rend(); it++){
+        RetransElem *e = *it;
+        if(e->sacked){
+            sacked_after++;
+            continue;
+        }
+        if(e->lost && !e->resent){
+            continue;
+        }
+        bool rack_lost = false;
+        if((rack_xmit_time != 0) && 
+           ((e->xmit_time < rack_xmit_time) || 
+            ((e->xmit_time == rack_xmit_time) && SEQ_LT(e->end, rack_end))))
+        {
+            int64_t remaining = e->xmit_time + rack_rtt + reo_wnd - now;
+            if(remaining <= 0){
+                rack_lost = true;
+            }
+            else{
+                wait = std::max(wait, remaining);
+            }
+        }
+        if(e->lost){
+            // The retransmission is lost too.
+            if(rack_lost){
+                e->resent = false;
+                resent_bytes -= e->end - e->seq;
+                marked = true;
+            }
+            continue;
+        }
+        bool is_first = std::next(it) == retrans_list.rend();
+        if(rack_lost || (sacked_after >= DUPACK_THRESHOLD) || 
+           (first && is_first))
+        {
+            e->lost = true;
+            lost_bytes += e->end - e->seq;
+            marked = true;
+        }
+    }
+    if(wait > 0){
+        probe_timer = false;
+        armLossTimer(now + wait);
+    }
+    retrans_mutex.unlock();
+    return marked;
+}
+
+/**
+ * @brief Update the RACK state with segment E, sacked or acknowledged at 
+ * NOW. The caller holds `conn_mutex` and `retrans_mutex`.
+ * 
+ * @see RFC8985 6.1
+ */
+void 
+TCB::rackUpdate(RetransElem *e, int64_t now)
+{
+    int64_t rtt = now - e->xmit_time;
+    // An ACK sooner than the minimum RTT after a retransmission is for the 
+    // original one.
+    if(e->retransmitted && (rtt < min_rtt)){
+        return;
+    }
+    if(!e->retransmitted && ((min_rtt == 0) || (rtt < min_rtt))){
+        min_rtt = rtt;
+    }
+    if((e->xmit_time > rack_xmit_time) || 
+       ((e->xmit_time == rack_xmit_time) && SEQ_LT(rack_end, e->end)))
+    {
+        rack_xmit_time = e->xmit_time;
+        rack_end = e->end;
+        rack_rtt = rtt;
+    }
+}
+
+/**
+ * @brief Get the probe timeout, two SRTTs plus the delay of a delayed ACK 
+ * if only one segment is outstanding, but no more than the RTO. The caller 
+ * holds `conn_mutex` and `retrans_mutex`.
+ * 
+ * @see RFC8985 7.2
+ */
+int64_t 
+TCB::getPTO()
+{
+    if(srtt == 0){
+        return getRTO();
+    }
+    int64_t pto = 2 * srtt;
+    if(cong.inflight <= cong.mss){
+        pto += TLP_MAX_ACK_DELAY;
+    }
+    pto = std::max(pto, (int64_t)RETRANS_TICK * 1000);
+    return std::min(pto, getRTO());
+}
+
+/**
+ * @brief Arm `loss_timer` for a tail loss probe a PTO after NOW, unless the 
+ * connection isn't established or is in recovery, a probe is outstanding, 
+ * segments deemed lost wait to be retransmitted, or the timer waits for 
+ * reordering. The caller holds `conn_mutex` and 
+ * `retrans_mutex`.
+ */
+void 
+TCB::armProbeTimer(int64_t now)
+{
+    if((cong.mss == 0) || in_recovery || tlp_active || (lost_bytes != 0) || 
+       retrans_list.empty() || 
+       (!probe_timer && getTimers().isArmed(&loss_timer)))
+    {
+        return;
+    }
+    probe_timer = true;
+    armLossTimer(now + getPTO());
+}
+
+/**
+ * @brief Arm or re-arm `loss_timer` to expire at EXPIRES(in microseconds). 
+ * The caller holds `retrans_mutex`.
+ */
+void 
+TCB::armLossTimer(int64_t expires)
+{
+    if(!getTimers().arm(&loss_timer, expires)){
+        hold();
+    }
+}
+
+/**
+ * @brief Cancel `loss_timer`. The caller holds `retrans_mutex` and a 
+ * reference to the TCB.
+ */
+void 
+TCB::cancelLossTimer()
+{
+    if(getTimers().cancel(&loss_timer)){
+        release();
+    }
+}
+
+/**
+ * @brief After a timeout, forget what's sacked, as the other end may have 
+ * discarded it, and deem all the segments outstanding lost. Those sent 
+ * since SINCE(in microseconds), i.e., by the timeout, count as 
+ * retransmitted, and the rest are retransmitted as ACKs open the window, 
+ * i.e., go-back-N in slow start. The caller holds `conn_mutex`.
+ * 
+ * @see RFC6675 5.1
+ */
+void 
+TCB::markAllLost(int64_t since)
+{
+    retrans_mutex.lock();
+    sacked_bytes = lost_bytes = resent_bytes = 0;
+    for(auto e: retrans_list){
+        e->sacked = false;
+        e->lost = true;
+        e->resent = e->xmit_time >= since;
+        lost_bytes += e->end - e->seq;
+        if(e->resent){
+            resent_bytes += e->end - e->seq;
+        }
+    }
+    retrans_mutex.unlock();
 }
\ No newline at end of file
@@ -11,23 +11,42 @@
 #include <ethernet/endian.h>
 #include <tcp/real_socket.h>
 #include <tcp/tcp.h>
+#include <netinet/tcp.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <time.h>
 #include <unistd.h>
+#include <algorithm>
 #include <cstdlib>
 #include <iostream>
 #include <mutex>
+#include <vector>
 
 #define SOMAXCONN 4096
 
+FdTable TransportLayer::fds;
+
+/**
+ * @brief Obtain time in microseconds.
+ */
+static int64_t 
+getTimeMicro()
+{
+    auto duration = std::chrono::high_resolution_clock::now()
+                    .time_since_epoch();
+    return std::chrono::duration_cast<std::chrono::microseconds>(duration)
+           .count();
+}
+
 /**
  * @brief Constructor of `TransportLayer`. Open "/dev/null" as a default file 
  * descriptor. This is used for allocating new file descriptors while remaining 
  * the semantics of the standard one.
  */
-TransportLayer::TransportLayer(): fd2tcb(), tcbs(), bitmap(PORT_END)
+TransportLayer::TransportLayer(): 
+    fd2tcb(), tcbs(), bitmap(PORT_END), fd2udp(), port2udp(), 
+    next_udp_port(PORT_BEGIN)
 {
     default_fd = open("/dev/null", O_RDWR, 0);
     if(default_fd < 0){
@@ -53,6 +72,10 @@ TransportLayer::~TransportLayer()
         delete i.second;
         fd2tcb.erase(i.first);
     }
+    for(auto &i: fd2udp) {
+        __real_close(i.first);
+        delete i.second;
+    }
 }
 
 /**
@@ -62,19 +85,15 @@ TransportLayer::~TransportLayer()
 TransportLayer &
 TransportLayer::getInstance()
 {
-    static TransportLayer *instance = NULL;
-    static std::mutex mutex;
-    mutex.lock();
-    if(!instance){
-        instance = new TransportLayer();
-    }
-    mutex.unlock();
-
+    // Initialization of a static local is thread safe, and once it's done, 
+    // a call only checks its guard.
+    static TransportLayer *instance = new TransportLayer();
     return *instance;
 }
 
 /**
- * @brief Create an empty socket with its transimission control block.
+ * @brief Create an empty socket with its transimission control block, or a 
+ * UDP socket.
  * @details Check whether arguments are supported. 
  * Allocate a new file descriptor for the socket. 
  * Create a new `Socket` instance.
@@ -82,6 +101,24 @@ TransportLayer::getInstance()
 int 
 TransportLayer::_socket(int domain, int type, int protocol)
 {
+    if((domain == AF_INET) && (type == SOCK_DGRAM) && 
+       ((protocol == 0) || (protocol == IPPROTO_UDP)))
+    {
+        int fd = dup(default_fd);
+        if(fd == -1){
+            return -1;
+        }
+        UDPSocket *udp = new UDPSocket();
+        udp_mutex.lock();
+        fd2udp[fd] = udp;
+        udp_mutex.unlock();
+        if(!fds.publishUDP(fd)){
+            closeUDP(fd);
+            errno = EMFILE;
+            return -1;
+        }
+        return fd;
+    }
     if((domain != AF_INET) || (type != SOCK_STREAM)) {
         return __real_socket(domain, type, protocol);
     }
@@ -90,10 +127,19 @@ TransportLayer::_socket(int domain, int type, int protocol)
     }
 
     int fd = dup(default_fd);
+    if(fd == -1){
+        return -1;
+    }
+    if(fd >= FD_TABLE_SIZE){
+        __real_close(fd);
+        errno = EMFILE;
+        return -1;
+    }
     TCB *tcb = new TCB();
     tcb_mutex.lock();
     fd2tcb[fd] = tcb;
     tcbs.insert(tcb);
+    fds.publishTCP(fd, tcb);
     tcb_mutex.unlock();
     return fd;
 }
@@ -106,7 +152,27 @@ TransportLayer::_bind(int socket, const struct sockaddr *address,
     auto it = fd2tcb.find(socket);
     if(it == fd2tcb.end()){
         tcb_mutex.unlock();
-        return __real_bind(socket, address, address_len);
+        UDPSocket *udp = acquireUDP(socket);
+        if(udp == NULL){
+            return __real_bind(socket, address, address_len);
+        }
+        const struct sockaddr_in *addr = (const struct sockaddr_in *)address;
+        int rc;
+        if(address_len != sizeof(struct sockaddr_in)){
+            errno = EINVAL;
+            rc = -1;
+        }
+        else if(addr->sin_family != AF_INET){
+            errno = EAFNOSUPPORT;
+            rc = -1;
+        }
+        else{
+            udp->bind_mutex.lock();
+            rc = bindUDP(udp, addr->sin_addr, addr->sin_port);
+            udp->bind_mutex.unlock();
+        }
+        releaseUDP(udp);
+        return rc;
     }
     // Invalid `address_len`
     if(address_len != sizeof(struct sockaddr_in)){
@@ -219,6 +285,9 @@ TransportLayer::_listen(int socket, int backlog)
     tcb->backlog = backlog;
     tcb->socket_state = SocketState::PASSIVE;
     tcb->state = ConnectionState::LISTEN;
+    listen_mutex.lock();
+    port2listener[tcb->src_port] = tcb;
+    listen_mutex.unlock();
     tcb->bind_mutex.unlock();
     return 0;
 }
@@ -231,7 +300,37 @@ TransportLayer::_connect(int socket, const struct sockaddr *address,
     auto it = fd2tcb.find(socket);
     if(it == fd2tcb.end()){
         tcb_mutex.unlock();
-        return __real_connect(socket, address, address_len);
+        UDPSocket *udp = acquireUDP(socket);
+        if(udp == NULL){
+            return __real_connect(socket, address, address_len);
+        }
+        // Connecting a UDP socket only sets its default destination.
+        const struct sockaddr_in *addr = (const struct sockaddr_in *)address;
+        int rc = 0;
+        udp->bind_mutex.lock();
+        if(address_len != sizeof(struct sockaddr_in)){
+            errno = EINVAL;
+            rc = -1;
+        }
+        else if(addr->sin_family != AF_INET){
+            errno = EAFNOSUPPORT;
+            rc = -1;
+        }
+        else if(!udp->bound){
+            struct in_addr any;
+            any.s_addr = INADDR_ANY;
+            rc = bindUDP(udp, any, 0);
+        }
+        if(rc == 0){
+            udp_mutex.lock();
+            udp->dst_addr = addr->sin_addr;
+            udp->dst_port = addr->sin_port;
+            udp->connected = true;
+            udp_mutex.unlock();
+        }
+        udp->bind_mutex.unlock();
+        releaseUDP(udp);
+        return rc;
     }
 
     // Invalid `address_len`
@@ -274,9 +373,15 @@ TransportLayer::_connect(int socket, const struct sockaddr *address,
     struct sockaddr_in *address_in = (struct sockaddr_in *)address;
     tcb->dst_addr = address_in->sin_addr;
     tcb->dst_port = address_in->sin_port;
+    if(!conns.insert(tcb)){
+        tcb->conn_mutex.unlock();
+        errno = EADDRINUSE;
+        return -1;
+    }
 
     // Send SYN
     if(!sendSegment(tcb, SegmentType::SYN, NULL, 0)){
+        conns.erase(tcb);
         tcb->conn_mutex.unlock();
         errno = ECONNREFUSED;
         return -1;
@@ -285,9 +390,13 @@ TransportLayer::_connect(int socket, const struct sockaddr *address,
     tcb->conn_mutex.unlock();
     sem_wait(&tcb->semaphore);
     if(tcb->state == ConnectionState::CLOSED){
+        tcb_mutex.lock();
+        tcbs.erase(tcb);
+        tcb_mutex.unlock();
+        conns.erase(tcb);
         bitmap.bitmap_reset(change_order(tcb->src_port));
-        delete tcb;
-        errno = EBADF;
+        errno = tcb->error != 0 ? tcb->error : EBADF;
+        tcb->release();
         return -1;
     }
     return 0;
@@ -319,20 +428,35 @@ TransportLayer::_accept(int socket, struct sockaddr *address,
     listen_tcb->bind_mutex.lock();
     listen_tcb->accepting_cnt--;
     if(listen_tcb->state == ConnectionState::CLOSED){
-        if(listen_tcb->accepting_cnt == 0){
+        bool last = listen_tcb->accepting_cnt == 0;
+        listen_tcb->bind_mutex.unlock();
+        if(last){
             bitmap.bitmap_delete(change_order(listen_tcb->src_port));
-            delete listen_tcb;
+            listen_tcb->release();
         }
-        listen_tcb->bind_mutex.unlock();
         errno = EINVAL;
         return -1;
     }
     listen_tcb->bind_mutex.unlock();
 
+    // Create file description for the connection. If it can't be, the 
+    // connection is left for another call.
+    int fd = dup(default_fd);
+    if((fd == -1) || (fd >= FD_TABLE_SIZE)){
+        if(fd != -1){
+            __real_close(fd);
+        }
+        sem_post(&listen_tcb->semaphore);
+        errno = EMFILE;
+        return -1;
+    }
+
     tcb_mutex.lock();
     listen_tcb->pending_mutex.lock();
     if(listen_tcb->pending.empty()){
         listen_tcb->pending_mutex.unlock();
+        tcb_mutex.unlock();
+        __real_close(fd);
         errno = EINVAL;
         return -1;
     }
@@ -340,11 +464,16 @@ TransportLayer::_accept(int socket, struct sockaddr *address,
     listen_tcb->pending.pop_front();
     bitmap.bitmap_add(change_order(conn_tcb->src_port));
     listen_tcb->pending_mutex.unlock();
+    // The connection no longer refers to the listening socket.
+    conn_tcb->conn_mutex.lock();
+    conn_tcb->listener = NULL;
+    conn_tcb->conn_mutex.unlock();
+    listen_tcb->release();
 
-    // Create file description and bind it to the connected tcb.
-    int fd = dup(default_fd);
+    // Bind the file description to the connected tcb.
     fd2tcb[fd] = conn_tcb;
     tcbs.insert(conn_tcb);
+    fds.publishTCP(fd, conn_tcb);
     tcb_mutex.unlock();
 
     // Return address
@@ -366,22 +495,26 @@ TransportLayer::_accept(int socket, struct sockaddr *address,
 ssize_t 
 TransportLayer::_read(int fildes, void *buf, size_t nbyte)
 {
-    tcb_mutex.lock();
-    auto it = fd2tcb.find(fildes);
-    if(it == fd2tcb.end()){
-        tcb_mutex.unlock();
-        return __real_read(fildes, buf, nbyte);
+    // Only the TCB's own locks are taken. The reference keeps it from being 
+    // deleted by a concurrent close.
+    TCB *tcb = fds.acquireTCB(fildes);
+    if(tcb == NULL){
+        UDPSocket *udp = acquireUDP(fildes);
+        if(udp == NULL){
+            return __real_read(fildes, buf, nbyte);
+        }
+        releaseUDP(udp);
+        return _recvfrom(fildes, buf, nbyte, 0, NULL, NULL);
     }
 
-    TCB *tcb = it->second;
     ssize_t nread = 0, n;
     tcb->conn_mutex.lock();
-    tcb_mutex.unlock();
     if((tcb->state != ConnectionState::ESTABLISHED) && 
        (tcb->state != ConnectionState::CLOSE_WAIT))
     {
+        errno = tcb->error != 0 ? tcb->error : ENOTCONN;
         tcb->conn_mutex.unlock();
-        errno = ENOTCONN;
+        tcb->release();
         return -1;
     }
     tcb->reading_cnt++;
@@ -390,20 +523,49 @@ TransportLayer::_read(int fildes, void *buf, size_t nbyte)
     // Busy waiting can happen here
     u_char *bufp = (u_char *)buf;
     bool push = false;
+    bool polling = false;
+    std::chrono::steady_clock::time_point poll_deadline;
     while(nbyte > 0){
         push = tcb->readWindow(bufp, nbyte, &n);
         if(n > 0){
             nbyte -= n;
             nread += n;
             bufp += n;
+            polling = false;
         }
-        if((tcb->state == ConnectionState::CLOSE_WAIT) || push){
+        if((tcb->state == ConnectionState::CLOSE_WAIT) || 
+           (tcb->state == ConnectionState::CLOSED) || push)
+        {
             break;
         }
+        if((n == 0) && (tcb->busy_poll > 0)){
+            // Receive the data in this thread rather than wait for the 
+            // receiving thread to hand it over, for at most `busy_poll`.
+            auto now = std::chrono::steady_clock::now();
+            if(!polling){
+                polling = true;
+                poll_deadline = now + 
+                                std::chrono::microseconds(tcb->busy_poll);
+            }
+            if(now < poll_deadline){
+                network_layer->busyPoll(tcb->dst_addr);
+            }
+        }
     }
 
     tcb->conn_mutex.lock();
-    if(nread > 0){
+    if(tcb->state == ConnectionState::CLOSED){
+        // Aborted
+        tcb->reading_cnt--;
+        if(nread == 0){
+            errno = tcb->error;
+            nread = -1;
+        }
+        tcb->conn_mutex.unlock();
+        tcb->release();
+        return nread;
+    }
+    if((nread > 0) && tcb->windowUpdateDue()){
         sendSegment(tcb, SegmentType::ACK, NULL, 0);
     }
     tcb->reading_cnt--;
@@ -414,76 +576,112 @@ TransportLayer::_read(int fildes, void *buf, size_t nbyte)
         }
     }
     tcb->conn_mutex.unlock();
+    tcb->release();
 
     return nread;
 }
 
 /**
- * @note It won't block if the window size of the other end is 0.
+ * @brief Send data as the send window, i.e., the smaller of the congestion 
+ * window and the window of the other end, opens. It blocks until all data 
+ * is sent or the connection is closed.
  */
 ssize_t 
 TransportLayer::_write(int fildes, const void *buf, size_t nbyte)
 {
     size_t nwrite = 0;
-    tcb_mutex.lock();
-    auto it = fd2tcb.find(fildes);
-    if(it == fd2tcb.end()){
-        tcb_mutex.unlock();
-        return __real_write(fildes, buf, nbyte);
+    TCB *tcb = fds.acquireTCB(fildes);
+    if(tcb == NULL){
+        UDPSocket *udp = acquireUDP(fildes);
+        if(udp == NULL){
+            return __real_write(fildes, buf, nbyte);
+        }
+        releaseUDP(udp);
+        return _sendto(fildes, buf, nbyte, 0, NULL, 0);
     }
 
-    TCB *tcb = it->second;
-    u_short dest_window;
     tcb->conn_mutex.lock();
-    tcb_mutex.unlock();
     if((tcb->state == ConnectionState::FIN_WAIT1) || 
        (tcb->state == ConnectionState::FIN_WAIT2))
     {
         tcb->conn_mutex.unlock();
+        tcb->release();
         // return EOF
         return 0;
     }
     if(tcb->state != ConnectionState::ESTABLISHED){
         tcb->conn_mutex.unlock();
+        tcb->release();
         // NOTE: The behavior of writing to a listening socket can be 
         // different on Linux machines.
-        errno = EPIPE;
+        errno = tcb->error != 0 ? tcb->error : EPIPE;
         return -1;
     }
     tcb->writing_cnt++;
-    tcb->conn_mutex.unlock();
 
-    // Busy waiting can happen here
+    // `conn_mutex` is released while waiting for ACKs to open the window. 
+    // The wait times out so that a window closed by the other end is probed.
+    std::unique_lock<std::mutex> lock(tcb->conn_mutex, std::adopt_lock);
     const u_char *bufp = (const u_char *)buf;
-    while(nbyte > 0){
-        dest_window = tcb->getDestWindow();
-        if(dest_window >= nbyte){
-            tcb->conn_mutex.lock();
-            sendSegment(tcb, SegmentType::ACK, bufp, nbyte);
-            tcb->conn_mutex.unlock();
-            nwrite += nbyte;
-            bufp += nbyte;
-            nbyte = 0;
-            tcb->setDestWindow(dest_window - nbyte);
+    while((nbyte > 0) && 
+          ((tcb->state == ConnectionState::ESTABLISHED) || 
+           (tcb->state == ConnectionState::CLOSE_WAIT)))
+    {
+        unsigned int mss = getMaxSegSize(tcb);
+        unsigned int window = tcb->getSendWindow();
+        size_t len = std::min(nbyte, (size_t)window);
+        // Avoid silly windows(RFC1122 4.2.3.4) while data is in flight.
+        if((len == 0) || 
+           ((len < mss) && (len < nbyte) && (tcb->cong.inflight != 0)))
+        {
+            if(tcb->cong.inflight == 0){
+                // Zero window of the other end. Send a byte at a time.
+                len = 1;
+            }
+            else{
+                tcb->send_cond.wait_for(lock, std::chrono::milliseconds(10));
+                continue;
+            }
         }
-        else if(dest_window > 0){
-            tcb->conn_mutex.lock();
-            sendSegment(tcb, SegmentType::ACK, bufp, dest_window);
-            tcb->conn_mutex.unlock();
-            nwrite += dest_window;
-            bufp += dest_window;
-            nbyte -= dest_window;
-            tcb->setDestWindow(0);
+        // Pause while the device is backlogged, rather than have segments 
+        // dropped and retransmitted. `conn_mutex` is released meanwhile, 
+        // so that the receiving thread can still process segments.
+        if(!network_layer->isWritable(tcb->dst_addr)){
+            tcb->send_cond.wait_for(lock, 
+                                    std::chrono::microseconds(WRITABLE_WAIT));
+            continue;
         }
-        if((tcb->state != ConnectionState::ESTABLISHED) && 
-           (tcb->state != ConnectionState::CLOSE_WAIT))
-        {
-            break;
+        // Paced segments go out about a millisecond's worth at a time.
+        if(tcb->cong.pacing_rate != 0){
+            int64_t delay = tcb->getPaceDelay();
+            if(delay > 0){
+                tcb->send_cond.wait_for(lock, std::chrono::microseconds(delay));
+                continue;
+            }
+            size_t quantum = std::max((size_t)(tcb->cong.pacing_rate / 1000), 
+                                      (size_t)(2 * mss));
+            len = std::min(len, std::min(quantum, (size_t)MAX_PACE_QUANTUM));
         }
+        sendSegment(tcb, SegmentType::ACK, bufp, len);
+        tcb->pace(len);
+        nwrite += len;
+        bufp += len;
+        nbyte -= len;
     }
+    lock.release();
 
-    tcb->conn_mutex.lock();
     tcb->writing_cnt--;
+    if(tcb->state == ConnectionState::CLOSED){
+        // Aborted
+        int error = tcb->error;
+        tcb->conn_mutex.unlock();
+        tcb->release();
+        if(nwrite == 0){
+            errno = error;
+            return -1;
+        }
+        return nwrite;
+    }
     if(tcb->closed){
         if((tcb->reading_cnt == 0) && (tcb->writing_cnt == 0)){
             tcb->state = ConnectionState::FIN_WAIT1;
@@ -491,6 +689,7 @@ TransportLayer::_write(int fildes, const void *buf, size_t nbyte)
         }
     }
     tcb->conn_mutex.unlock();
+    tcb->release();
     
     return nwrite;
 }
@@ -535,6 +734,9 @@ TransportLayer::_close(int fildes)
     auto it = fd2tcb.find(fildes);
     if(it == fd2tcb.end()){
         tcb_mutex.unlock();
+        if(closeUDP(fildes) == 0){
+            return 0;
+        }
         return __real_close(fildes);
     }
 
@@ -543,46 +745,75 @@ TransportLayer::_close(int fildes)
     if(tcb->socket_state == SocketState::UNSPECIFIED){
         // Put erasure before deletion to prevent other functions from finding 
         // this tcb.
+        fds.retractTCB(fildes);
         __real_close(fildes);
         fd2tcb.erase(fildes);
         tcbs.erase(tcb);
         tcb_mutex.unlock();
         // Wait for potential `bind()` to finish to avoid segmentation fault
         tcb->bind_mutex.unlock();
-        delete tcb;
+        tcb->release();
         return 0;
     }
 
     if(tcb->socket_state == SocketState::BOUND){
+        fds.retractTCB(fildes);
         __real_close(fildes);
         fd2tcb.erase(fildes);
         tcbs.erase(tcb);
         tcb_mutex.unlock();
         tcb->bind_mutex.unlock();
-        delete tcb;
+        tcb->release();
         return 0;
     }
 
     if(tcb->socket_state == SocketState::PASSIVE){
+        fds.retractTCB(fildes);
         __real_close(fildes);
         fd2tcb.erase(fildes);
         tcbs.erase(tcb);
         tcb_mutex.unlock();
+        listen_mutex.lock();
+        port2listener.erase(tcb->src_port);
+        listen_mutex.unlock();
         tcb->state = ConnectionState::CLOSED;
-        if(tcb->accepting_cnt == 0){
-            bitmap.bitmap_delete(change_order(tcb->src_port));
-            delete tcb;
+
+        // Connections not accepted yet are closed with the listening socket.
+        // Each of them holds a reference to it.
+        std::vector<TCB *> children(tcb->received.begin(), 
+                                    tcb->received.end());
+        tcb->received.clear();
+        tcb->pending_mutex.lock();
+        children.insert(children.end(), tcb->pending.begin(), 
+                        tcb->pending.end());
+        tcb->pending.clear();
+        tcb->pending_mutex.unlock();
+        for(auto i: children){
+            conns.erase(i);
+            i->conn_mutex.lock();
+            i->listener = NULL;
+            i->state = ConnectionState::CLOSED;
+            i->conn_mutex.unlock();
+            tcb->release();
+            i->release();
         }
-        else{
+
+        bool last = tcb->accepting_cnt == 0;
+        if(!last){
             for(int i = 0; i < tcb->accepting_cnt; i++){
                 sem_post(&tcb->semaphore);
             }
         }
         tcb->bind_mutex.unlock();
+        if(last){
+            bitmap.bitmap_delete(change_order(tcb->src_port));
+            tcb->release();
+        }
         return 0;
     }
     
     if(tcb->socket_state == SocketState::ACTIVE){
+        fds.retractTCB(fildes);
         __real_close(fildes);
         fd2tcb.erase(fildes);
         tcb->conn_mutex.lock();
@@ -594,6 +825,13 @@ TransportLayer::_close(int fildes)
             sem_post(&tcb->semaphore);
             return 0;
         }
+        if(tcb->state == ConnectionState::CLOSED){
+            // Aborted. It's out of the tables already.
+            tcb->conn_mutex.unlock();
+            bitmap.bitmap_delete(change_order(tcb->src_port));
+            tcb->release();
+            return 0;
+        }
         if(tcb->state == ConnectionState::ESTABLISHED){
             tcb->closed = true;
             if((tcb->reading_cnt == 0) && (tcb->writing_cnt == 0)){
@@ -601,7 +839,7 @@ TransportLayer::_close(int fildes)
                 sendSegment(tcb, SegmentType::FIN_ACK, NULL, 0);
                 tcb->conn_mutex.unlock();
                 sem_wait(&tcb->fin_sem);
-                delete tcb;
+                tcb->release();
             }
             else{
                 tcb->conn_mutex.unlock();
@@ -615,7 +853,7 @@ TransportLayer::_close(int fildes)
                 sendSegment(tcb, SegmentType::FIN_ACK, NULL, 0);
                 tcb->conn_mutex.unlock();
                 sem_wait(&tcb->fin_sem);
-                delete tcb;
+                tcb->release();
             }
             else{
                 tcb->conn_mutex.unlock();
@@ -662,9 +900,11 @@ TransportLayer::_getaddrinfo(const char *node, const char *service,
 
     if(valid){
         if(hints != NULL){
-            if((hints->ai_family != AF_INET) || 
-               (hints->ai_socktype != SOCK_STREAM) ||
-               (hints->ai_protocol != IPPROTO_TCP) ||
+            bool stream = (hints->ai_socktype == SOCK_STREAM) &&
+                          (hints->ai_protocol == IPPROTO_TCP);
+            bool dgram = (hints->ai_socktype == SOCK_DGRAM) &&
+                         (hints->ai_protocol == IPPROTO_UDP);
+            if((hints->ai_family != AF_INET) || (!stream && !dgram) ||
                (hints->ai_flags != 0))
             {
                 valid = false;
@@ -707,6 +947,87 @@ TransportLayer::_getaddrinfo(const char *node, const char *service,
     return 0;
 }
 
+/**
+ * @brief Set a socket option. IP_TOS sets the Type of Service of packets 
+ * sent on the socket, which selects their class in the egress scheduler. 
+ * SO_BUSY_POLL sets the microseconds a reader finding no data polls the 
+ * device itself before waiting for the receiving thread. TCP_CONGESTION 
+ * selects the congestion control algorithm by name, which connections 
+ * accepted on a listening socket inherit. SO_REUSEADDR is accepted and 
+ * ignored.
+ * 
+ * @see https://man7.org/linux/man-pages/man7/ip.7.html
+ * @see https://man7.org/linux/man-pages/man7/tcp.7.html
+ */
+int 
+TransportLayer::_setsockopt(int socket, int level, int option_name, 
+                            const void *option_value, socklen_t option_len)
+{
+    UDPSocket *udp = NULL;
+    TCB *tcb = fds.acquireTCB(socket);
+    if(tcb == NULL){
+        udp = acquireUDP(socket);
+        if(udp == NULL){
+            return __real_setsockopt(socket, level, option_name, 
+                                     option_value, option_len);
+        }
+    }
+
+    int rc = 0;
+    if((level == SOL_SOCKET) && (option_name == SO_REUSEADDR)){
+        // Ports are released as soon as sockets close, so there's nothing 
+        // to reuse.
+    }
+    else if((level == IPPROTO_IP) && (option_name == IP_TOS)){
+        if(option_len < sizeof(int)){
+            errno = EINVAL;
+            rc = -1;
+        }
+        else if(tcb != NULL){
+            tcb->tos = *(const int *)option_value;
+        }
+        else{
+            udp->tos = *(const int *)option_value;
+        }
+    }
+    else if((level == SOL_SOCKET) && (option_name == SO_BUSY_POLL)){
+        if((option_len < sizeof(int)) || (*(const int *)option_value < 0)){
+            errno = EINVAL;
+            rc = -1;
+        }
+        else if(tcb != NULL){
+            tcb->busy_poll = *(const int *)option_value;
+        }
+        else{
+            udp->busy_poll = *(const int *)option_value;
+        }
+    }
+    else if((level == IPPROTO_TCP) && (option_name == TCP_CONGESTION) && 
+            (tcb != NULL))
+    {
+        char name[CONGESTION_NAME_MAX] = {0};
+        memcpy(name, option_value, 
+               std::min((size_t)option_len, sizeof(name) - 1));
+        tcb->conn_mutex.lock();
+        if(!tcb->setCongestion(name)){
+            errno = ENOENT;
+            rc = -1;
+        }
+        tcb->conn_mutex.unlock();
+    }
+    else{
+        errno = ENOPROTOOPT;
+        rc = -1;
+    }
+    if(tcb != NULL){
+        tcb->release();
+    }
+    if(udp != NULL){
+        releaseUDP(udp);
+    }
+    return rc;
+}
+
 /**
  * @brief Generate an unused port number using bitmap.
  * @return `BITMAP_ERROR` on error, port number on success.
@@ -719,10 +1040,50 @@ TransportLayer::generatePort()
 }
 
 /**
- * @brief Send a TCP segment.
+ * @brief Get the maximum length of data in a segment sent on TCB, i.e., the 
+ * MSS the other end announced, limited by the path MTU.
+ * 
+ * @see RFC879 & RFC1191
+ */
+int 
+TransportLayer::getMaxSegSize(TCB *tcb)
+{
+    int mss = tcb->getMaxSegSize();
+    if(mss == -1){
+        mss = DEFAULT_MSS;
+    }
+    int mtu = network_layer->getPathMTU(tcb->dst_addr);
+    if(mtu != -1){
+        mss = std::min(mss, mtu - SIZE_IPv4 - SIZE_TCP);
+    }
+    return mss;
+}
+
+/**
+ * @brief Get the MSS announced in SYN segments sent on TCB, i.e., the MTU of 
+ * the device segments to the other end are sent on, less the headers. Jumbo 
+ * frames thus raise it above the usual 1460.
+ */
+int 
+TransportLayer::getAdvertisedMSS(TCB *tcb)
+{
+    int mtu = network_layer->getMTU(tcb->dst_addr);
+    if(mtu == -1){
+        mtu = MAX_PAYLOAD;
+    }
+    return mtu - SIZE_IPv4 - SIZE_TCP;
+}
+
+/**
+ * @brief Send a TCP segment. Data longer than the MSS is split into several 
+ * segments. SYN segments carry the MSS and SACK-permitted options, and pure 
+ * ACKs carry SACK blocks of the data held out of order, after a D-SACK 
+ * block of any duplicate just received. The caller holds 
+ * `conn_mutex`, unless the connection isn't shared yet.
  * 
  * @param
- * @return `true` on success, `false` on error.
+ * @return `true` on success, `false` on error. Data that failed to be sent 
+ * is still queued for retransmission.
  */
 bool 
 TransportLayer::sendSegment(TCB *tcb, SegmentType::SegmentType type, 
@@ -730,25 +1091,68 @@ TransportLayer::sendSegment(TCB *tcb, SegmentType::SegmentType type,
 {
     int times, length = len;
     const u_char *bufp = (const u_char *)buf;
+    int mss = getMaxSegSize(tcb);
+    u_char options[MAX_OPTIONS_LEN];
+    int options_len = 0;
+    if((type == SegmentType::SYN) || (type == SegmentType::SYN_ACK)){
+        tcb->rcv_mss = getAdvertisedMSS(tcb);
+        u_short advertised = change_order((u_short)tcb->rcv_mss);
+        options[0] = OptionType::MAX_SEG_SIZE;
+        options[1] = MSS_OPTION_LEN;
+        memcpy(options + 2, &advertised, 2);
+        options_len = MSS_OPTION_LEN;
+        // SACK is offered on SYN, and accepted on SYN-ACK if offered.
+        if((type == SegmentType::SYN) || tcb->sack_ok){
+            options[options_len++] = OptionType::NO_OP;
+            options[options_len++] = OptionType::NO_OP;
+            options[options_len++] = OptionType::SACK_PERMITTED;
+            options[options_len++] = SACK_PERM_OPTION_LEN;
+        }
+    }
+    else if((type == SegmentType::ACK) && (len == 0) && tcb->sack_ok && 
+            (tcb->dsack_pending || !tcb->ooo.empty()))
+    {
+        unsigned int blocks[MAX_SACK_BLOCKS][2];
+        int n = 0;
+        if(tcb->dsack_pending){
+            blocks[0][0] = tcb->dsack[0];
+            blocks[0][1] = tcb->dsack[1];
+            tcb->dsack_pending = false;
+            n++;
+        }
+        n += tcb->ooo.getBlocks(blocks + n, MAX_SACK_BLOCKS - n);
+        options[options_len++] = OptionType::NO_OP;
+        options[options_len++] = OptionType::NO_OP;
+        options[options_len++] = OptionType::SACK;
+        options[options_len++] = 2 + n * SACK_BLOCK_LEN;
+        for(int i = 0; i < n; i++){
+            unsigned int edges[2] = {change_order(blocks[i][0]), 
+                                     change_order(blocks[i][1])};
+            memcpy(options + options_len, edges, SACK_BLOCK_LEN);
+            options_len += SACK_BLOCK_LEN;
+        }
+    }
     if(len == 0){
         times = 1;
     }
     else{
-        times = (len + MAX_SEG_LEN - 1) / MAX_SEG_LEN;
+        times = (len + mss - 1) / mss;
     }
+    bool sent = true;
     for(int i = 0; i < times; i++){
-        if(length > MAX_SEG_LEN){
-            len = MAX_SEG_LEN;
-            length -= MAX_SEG_LEN;
+        if(length > mss){
+            len = mss;
+            length -= mss;
         }
         else{
             len = length;
         }
 
         int rc;
-        int total_len = SIZE_PSEUDO + SIZE_TCP + len;
+        int header_len = SIZE_TCP + options_len;
+        int total_len = SIZE_PSEUDO + header_len + len;
         u_char *segment = new u_char[total_len];
-        memcpy(segment + SIZE_PSEUDO + SIZE_TCP, bufp, len);
+        memcpy(segment + SIZE_PSEUDO + header_len, bufp, len);
         bufp += len;
         PseudoHeader *pseudo_header = (PseudoHeader *)segment;
         TCPHeader *tcp_header = (TCPHeader *)(segment + SIZE_PSEUDO);
@@ -758,7 +1162,7 @@ TransportLayer::sendSegment(TCB *tcb, SegmentType::SegmentType type,
         pseudo_header->dst_addr = tcb->dst_addr;
         pseudo_header->zero = 0;
         pseudo_header->protocol = IPPROTO_TCP;
-        pseudo_header->length = change_order((u_short)(SIZE_TCP + len));
+        pseudo_header->length = change_order((u_short)(header_len + len));
 
         // Port numbers
         tcp_header->src_port = tcb->src_port;
@@ -773,7 +1177,7 @@ TransportLayer::sendSegment(TCB *tcb, SegmentType::SegmentType type,
             tcp_header->ack = 0;
         }
         // Data Offset
-        tcp_header->data_off = DEFAULT_OFF;
+        tcp_header->data_off = SET_OFF(header_len);
         // Control Bits
         switch (type)
         {
@@ -810,28 +1214,47 @@ TransportLayer::sendSegment(TCB *tcb, SegmentType::SegmentType type,
             break;
         }
         // Window
-        tcp_header->window = change_order(tcb->getWindow());
+        tcb->adv_wnd = tcb->getWindow();
+        tcp_header->window = change_order(tcb->adv_wnd);
         // Checksum
         tcp_header->checksum = 0;
         // Urgent Pointer
         if(!(tcp_header->ctl_bits & ControlBits::URG)){
             tcp_header->urgent = 0;
         }
+        // Options
+        memcpy(segment + SIZE_PSEUDO + SIZE_TCP, options, options_len);
         tcp_header->checksum = calculate_checksum(segment, total_len);
 
         rc = network_layer->sendIPPacket(tcb->src_addr, tcb->dst_addr, 
                                          IPPROTO_TCP, segment + SIZE_PSEUDO, 
-                                         SIZE_TCP + len);
+                                         header_len + len, DEFAULT_TTL, 
+                                         tcb->tos);
         if(rc == -1){
             std::cerr << "Send segment error!" << std::endl;
+            sent = false;
+            // Data already takes sequence space, so a segment dropped on 
+            // the way out is retransmitted like one lost in the network.
+            if(len == 0){
+                delete[] segment;
+                return false;
+            }
+        }
+        else if(tcp_header->ctl_bits & ControlBits::ACK){
+            tcb->ackSent();
+        }
+        // Pure ACKs occupy no sequence space and are never retransmitted.
+        unsigned int seq = change_order(tcp_header->seq);
+        if(tcb->getSequence() != seq){
+            tcb->insertRetrans(segment, seq, tcb->getSequence(), 
+                               header_len + len);
+        }
+        else{
             delete[] segment;
-            return false;
         }
-        tcb->insertRetrans(segment, change_order(tcp_header->seq), 
-                           SIZE_TCP + len);
     }
     
-    return true;
+    return sent;
 }
 
 /**
@@ -850,9 +1273,13 @@ TransportLayer::callBack(const u_char *buf, int len,
     int rest_len = len;
     TCPHeader *tcp_header = (TCPHeader *)buf;
     PseudoHeader *pseudo_header = (PseudoHeader *)(buf - SIZE_PSEUDO);
-    unsigned int header_len, seq, ack_num;
+    int header_len;
+    unsigned int seq, ack_num;
     u_short window, max_seg;
     bool has_max_seg = false;
+    bool sack_permitted = false;
+    unsigned int sack_blocks[MAX_SACK_BLOCKS][2];
+    int sack_cnt = 0;
 
     // Calculate checksum
     pseudo_header->src_addr = src_addr;
@@ -872,15 +1299,51 @@ TransportLayer::callBack(const u_char *buf, int len,
     ack_num = change_order(tcp_header->ack);
     window = change_order(tcp_header->window);
     header_len = GET_OFF(tcp_header->data_off);
+    if((header_len < SIZE_TCP) || (header_len > len)){
+        std::cerr << "TCP data offset error!" << std::endl;
+        return false;
+    }
     rest_len -= header_len;
 
-    // Find maximum segment size option
-    for(int i = SIZE_TCP; i < header_len; i++){
-        if(buf[i] == OptionType::MAX_SEG_SIZE){
-            max_seg = change_order(*(u_short *)(buf + 2));
-            has_max_seg = true;
+    // Find the MSS, SACK-permitted and SACK options. Options other than End 
+    // of Option List and No-Operation have a length octet.
+    for(int i = SIZE_TCP; i < header_len; ){
+        if(buf[i] == OptionType::END){
+            break;
+        }
+        if(buf[i] == OptionType::NO_OP){
+            i++;
+            continue;
+        }
+        if((i + 1 >= header_len) || (buf[i + 1] < 2) || 
+           (i + buf[i + 1] > header_len))
+        {
             break;
         }
+        if((buf[i] == OptionType::MAX_SEG_SIZE) && 
+           (buf[i + 1] == MSS_OPTION_LEN))
+        {
+            max_seg = change_order(*(u_short *)(buf + i + 2));
+            has_max_seg = true;
+        }
+        else if((buf[i] == OptionType::SACK_PERMITTED) && 
+                (buf[i + 1] == SACK_PERM_OPTION_LEN))
+        {
+            sack_permitted = true;
+        }
+        else if((buf[i] == OptionType::SACK) && 
+                ((buf[i + 1] - 2) % SACK_BLOCK_LEN == 0))
+        {
+            int n = std::min((buf[i + 1] - 2) / SACK_BLOCK_LEN, 
+                             MAX_SACK_BLOCKS);
+            for(sack_cnt = 0; sack_cnt < n; sack_cnt++){
+                const u_char *block = buf + i + 2 + sack_cnt * SACK_BLOCK_LEN;
+                sack_blocks[sack_cnt][0] = change_order(*(unsigned int *)block);
+                sack_blocks[sack_cnt][1] = 
+                    change_order(*(unsigned int *)(block + 4));
+            }
+        }
+        i += buf[i + 1];
     }
 
     // Control bits
@@ -912,376 +1375,943 @@ TransportLayer::callBack(const u_char *buf, int len,
         type = SegmentType::ACK;
     }
 
-    bool flag = false;
-    switch (type)
+    // Demultiplex the segment. Connections, including those not accepted 
+    // yet, are found by the 4-tuple, and new ones by the listening socket on 
+    // the port. Both lookups take a reference, so no global lock is needed.
+    TCB *tcb = conns.find(dst_addr, tcp_header->dst_port, src_addr, 
+                          tcp_header->src_port);
+    TCB *listener = NULL;
+    if(tcb != NULL){
+        tcb->conn_mutex.lock();
+        listener = tcb->listener;
+        if(listener != NULL){
+            listener->hold();
+        }
+        tcb->conn_mutex.unlock();
+    }
+    else if(handleTimeWait(type, seq, dst_addr, tcp_header->dst_port, 
+                           src_addr, tcp_header->src_port))
     {
-    case SegmentType::RST:
-        tcb_mutex.lock();
-        for(auto it: tcbs){
-            if((it->state == ConnectionState::LISTEN) &&
-               (it->src_addr.s_addr == dst_addr.s_addr) && 
-               (it->src_port == tcp_header->dst_port))
-            {
-                for(auto i: it->received){
-                    if((i->dst_addr.s_addr == src_addr.s_addr) &&
-                       (i->dst_port == tcp_header->src_port))
-                    {
-                        flag = true;
-                        it->received.erase(i);
-                        delete i;
-                        break;
-                    }
-                }
-                break;
+        return true;
+    }
+    else{
+        listener = findListener(dst_addr, tcp_header->dst_port);
+    }
+
+    // Lists of a listening socket are protected by its `bind_mutex`, and 
+    // only used while it's listening.
+    if(listener != NULL){
+        listener->bind_mutex.lock();
+        if(listener->state != ConnectionState::LISTEN){
+            listener->bind_mutex.unlock();
+            listener->release();
+            if(tcb != NULL){
+                tcb->release();
             }
-            else if((it->state != ConnectionState::CLOSED) &&
-                    (it->src_addr.s_addr == dst_addr.s_addr) &&
-                    (it->src_port == tcp_header->dst_port) &&
-                    (it->dst_addr.s_addr == src_addr.s_addr) &&
-                    (it->dst_port == tcp_header->src_port))
-            {
+            return true;
+        }
+    }
 
-            }
-            if(flag){
-                break;
-            }
+    bool finished = false;
+    switch (type)
+    {
+    case SegmentType::RST:
+        if((tcb != NULL) && (listener != NULL) && 
+           (listener->received.erase(tcb) != 0))
+        {
+            conns.erase(tcb);
+            tcb->conn_mutex.lock();
+            tcb->listener = NULL;
+            tcb->conn_mutex.unlock();
+            listener->release();
+            tcb->release();
         }
-        tcb_mutex.unlock();
         break;
 
     case SegmentType::SYN:
-        tcb_mutex.lock();
-        for(auto it: tcbs)
-        {
-            if((it->state == ConnectionState::LISTEN) &&
-               (it->src_addr.s_addr == dst_addr.s_addr) && 
-               (it->src_port == tcp_header->dst_port))
-            {
-                if(it->pending.size() + it->received.size() < it->backlog)
-                {
-                    TCB *tcb = new TCB();
-                    tcb->src_addr = dst_addr;
-                    tcb->src_port = tcp_header->dst_port;
-                    tcb->dst_addr = src_addr;
-                    tcb->dst_port = tcp_header->src_port;
-                    tcb->socket_state = SocketState::ACTIVE;
-                    tcb->state = ConnectionState::SYN_RCVD;
-                    tcb->setAcknowledgement(seq + 1);
-                    tcb->setDestWindow(window);
-                    if(has_max_seg) it->setMaxSegSize(max_seg);
-                    it->received.insert(tcb);
-                    sendSegment(tcb, SegmentType::SYN_ACK, NULL, 0);
+        if(tcb != NULL){
+            // The SYN-ACK was lost. It's the only segment sent in SYN-RCVD.
+            if(tcb->state == ConnectionState::SYN_RCVD){
+                tcb->retrans_mutex.lock();
+                if(!tcb->retrans_list.empty()){
+                    RetransElem *e = tcb->retrans_list.front();
+                    network_layer->sendIPPacket(tcb->src_addr, tcb->dst_addr, 
+                                                IPPROTO_TCP, 
+                                                e->segment + SIZE_PSEUDO, 
+                                                e->len, DEFAULT_TTL, 
+                                                tcb->tos);
                 }
-                break;
+                tcb->retrans_mutex.unlock();
             }
         }
-        tcb_mutex.unlock();
+        else if((listener != NULL) && 
+                (listener->pending.size() + listener->received.size() < 
+                 listener->backlog))
+        {
+            TCB *child = new TCB();
+            child->src_addr = dst_addr;
+            child->src_port = tcp_header->dst_port;
+            child->dst_addr = src_addr;
+            child->dst_port = tcp_header->src_port;
+            child->socket_state = SocketState::ACTIVE;
+            child->state = ConnectionState::SYN_RCVD;
+            child->setAcknowledgement(seq + 1);
+            child->setDestWindow(window);
+            child->tos = listener->tos;
+            child->busy_poll = listener->busy_poll;
+            listener->conn_mutex.lock();
+            child->setCongestion(listener->cc->getName());
+            listener->conn_mutex.unlock();
+            listener->hold();
+            child->listener = listener;
+            if(has_max_seg) child->setMaxSegSize(max_seg);
+            child->sack_ok = sack_permitted;
+            listener->received.insert(child);
+            conns.insert(child);
+            sendSegment(child, SegmentType::SYN_ACK, NULL, 0);
+        }
         break;
     
     case SegmentType::SYN_ACK:
-        tcb_mutex.lock();
-        for(auto it: tcbs)
-        {
-            it->conn_mutex.lock();
-            if(it->state == ConnectionState::SYN_SENT){
-                if((it->src_addr.s_addr == dst_addr.s_addr) && 
-                   (it->src_port == tcp_header->dst_port) &&
-                   (it->dst_addr.s_addr == src_addr.s_addr) &&
-                   (it->dst_port == tcp_header->src_port))
-                {
-                    it->setAcknowledgement(seq + 1);
-                    it->setDestWindow(window);
-                    it->setSndUna(ack_num);
-                    if(has_max_seg) it->setMaxSegSize(max_seg);
-                    it->state = ConnectionState::ESTABLISHED;
-                    sendSegment(it, SegmentType::ACK, NULL, 0);
-                    it->conn_mutex.unlock();
-                    sem_post(&it->semaphore);
-                    break;
-                }
-            }
-            it->conn_mutex.unlock();
+        if((tcb == NULL) || (listener != NULL)){
+            break;
+        }
+        tcb->conn_mutex.lock();
+        if(tcb->state == ConnectionState::SYN_SENT){
+            tcb->setAcknowledgement(seq + 1);
+            tcb->setDestWindow(window);
+            tcb->acknowledge(ack_num);
+            if(has_max_seg) tcb->setMaxSegSize(max_seg);
+            tcb->sack_ok = sack_permitted;
+            tcb->initCongestion(getMaxSegSize(tcb));
+            tcb->state = ConnectionState::ESTABLISHED;
+            sendSegment(tcb, SegmentType::ACK, NULL, 0);
+            tcb->conn_mutex.unlock();
+            sem_post(&tcb->semaphore);
+        }
+        else{
+            tcb->conn_mutex.unlock();
         }
-        tcb_mutex.unlock();
         break;
     
     case SegmentType::ACK:
-        tcb_mutex.lock();
-        for(auto it: tcbs)
-        {
-            it->bind_mutex.lock();
-            it->conn_mutex.lock();
-            switch (it->state)
-            {
-            case ConnectionState::LISTEN:
-                it->conn_mutex.unlock();
-                if((it->socket_state == SocketState::PASSIVE) &&
-                   (it->src_addr.s_addr == dst_addr.s_addr) &&
-                   (it->src_port == tcp_header->dst_port))
-                {
-                    for(auto i: it->received)
-                    {
-                        if((i->dst_addr.s_addr == src_addr.s_addr) &&
-                           (i->dst_port == tcp_header->src_port))
-                        {
-                            i->setAcknowledgement(seq + rest_len);
-                            i->setDestWindow(window);
-                            i->state = ConnectionState::ESTABLISHED;
-                            it->received.erase(i);
-                            it->pending.push_back(i);
-                            sem_post(&it->semaphore);
-                            flag = true;
-                            break;
-                        }
-                    }
-                    if(flag){
-                        break;
-                    }
-                    for(auto i: it->pending)
-                    {
-                        if((i->dst_addr.s_addr == src_addr.s_addr) &&
-                           (i->dst_port == tcp_header->src_port))
-                        {
-                            flag = true;
-                            if(seq != i->getAcknowledgement()){
-                                break;
-                            }
-                            int size = i->getMaxSegSize();
-                            if((size != -1) && (size < len)){
-                                break;
-                            }
-                            i->setAcknowledgement(seq + rest_len);
-                            i->setDestWindow(window);
-                            i->setSndUna(ack_num);
-                            if(rest_len != 0){
-                                i->writeWindow(buf + header_len, rest_len, psh);
-                            }
-                            break;
-                        }
-                    }
-                }
-                break;
-
-            case ConnectionState::ESTABLISHED:
-                if((it->src_addr.s_addr == dst_addr.s_addr) && 
-                   (it->src_port == tcp_header->dst_port) &&
-                   (it->dst_addr.s_addr == src_addr.s_addr) &&
-                   (it->dst_port == tcp_header->src_port))
-                {
-                    flag = true;
-                    if(seq != it->getAcknowledgement()){
-                        it->conn_mutex.unlock();
-                        break;
-                    }
-                    int size = it->getMaxSegSize();
-                    if((size != -1) && (size < len)){
-                        it->conn_mutex.unlock();
-                        break;
-                    }
-                    it->setAcknowledgement(seq + rest_len);
-                    it->setDestWindow(window);
-                    it->setSndUna(ack_num);
-                    if(rest_len != 0){
-                        it->writeWindow(buf + header_len, rest_len, psh);
-                    }
-                    it->conn_mutex.unlock();
-                }
-                else{
-                    it->conn_mutex.unlock();
-                }
-                break;
-
-            case ConnectionState::FIN_WAIT1:
-                if((it->src_addr.s_addr == dst_addr.s_addr) && 
-                   (it->src_port == tcp_header->dst_port) &&
-                   (it->dst_addr.s_addr == src_addr.s_addr) &&
-                   (it->dst_port == tcp_header->src_port))
-                {
-                    flag = true;
-                    if(seq != it->getAcknowledgement()){
-                        it->conn_mutex.unlock();
-                        break;
-                    }
-                    it->setAcknowledgement(seq + rest_len);
-                    it->setDestWindow(window);
-                    if(rest_len != 0){
-                        it->writeWindow(buf + header_len, rest_len, psh);
-                        sendSegment(it, SegmentType::ACK, NULL, 0);
-                    }
-                    if(ack_num == it->getSequence()){
-                        it->state = ConnectionState::FIN_WAIT2;
-                    }
-                    it->setSndUna(ack_num);
-                    it->conn_mutex.unlock();
-                }
-                else{
-                    it->conn_mutex.unlock();
-                }
-                break;
-            
-            case ConnectionState::LAST_ACK:
-                if((it->src_addr.s_addr == dst_addr.s_addr) && 
-                   (it->src_port == tcp_header->dst_port) &&
-                   (it->dst_addr.s_addr == src_addr.s_addr) &&
-                   (it->dst_port == tcp_header->src_port))
-                {
-                    flag = true;
-                    if(ack_num == it->getSequence()){
-                        it->state = ConnectionState::CLOSED;
-                        it->conn_mutex.unlock();
-                        tcbs.erase(it);
-                        bitmap.bitmap_delete(change_order(it->src_port));
-                        sem_post(&it->fin_sem);
-                        break;
-                    }
-                }
-                it->conn_mutex.unlock();
-                break;
-            
-            default:
-                it->conn_mutex.unlock();
+        if(tcb == NULL){
+            break;
+        }
+        if(listener != NULL){
+            // Connection not accepted yet
+            if(listener->received.erase(tcb) != 0){
+                tcb->conn_mutex.lock();
+                tcb->setDestWindow(window);
+                tcb->acknowledge(ack_num);
+                tcb->initCongestion(getMaxSegSize(tcb));
+                tcb->state = ConnectionState::ESTABLISHED;
+                // The ACK may carry data already.
+                receiveData(tcb, seq, buf + header_len, rest_len, psh);
+                tcb->conn_mutex.unlock();
+                listener->pending_mutex.lock();
+                listener->pending.push_back(tcb);
+                listener->pending_mutex.unlock();
+                sem_post(&listener->semaphore);
                 break;
             }
-
-            it->bind_mutex.unlock();
-
-            if(flag){
-                break;
+            tcb->conn_mutex.lock();
+            if(receiveData(tcb, seq, buf + header_len, rest_len, psh)){
+                processAck(tcb, ack_num, window, rest_len, sack_blocks, 
+                           sack_cnt);
             }
+            tcb->conn_mutex.unlock();
+            break;
+        }
+
+        tcb->bind_mutex.lock();
+        tcb->conn_mutex.lock();
+        switch (tcb->state)
+        {
+        case ConnectionState::ESTABLISHED:
+            if(receiveData(tcb, seq, buf + header_len, rest_len, psh)){
+                processAck(tcb, ack_num, window, rest_len, sack_blocks, 
+                           sack_cnt);
+            }
+            break;
+
+        case ConnectionState::FIN_WAIT1:
+            if(!receiveData(tcb, seq, buf + header_len, rest_len, psh)){
+                break;
+            }
+            if(ack_num == tcb->getSequence()){
+                tcb->state = ConnectionState::FIN_WAIT2;
+            }
+            processAck(tcb, ack_num, window, rest_len, sack_blocks, sack_cnt);
+            break;
+
+        case ConnectionState::FIN_WAIT2:
+            // The other end may still send data.
+            receiveData(tcb, seq, buf + header_len, rest_len, psh);
+            break;
+
+        case ConnectionState::CLOSE_WAIT:
+            // Data may still be sent after the other end closed.
+            processAck(tcb, ack_num, window, 0, sack_blocks, sack_cnt);
+            break;
+        
+        case ConnectionState::CLOSING:
+            tcb->acknowledge(ack_num);
+            if(ack_num == tcb->getSequence()){
+                tcb->state = ConnectionState::TIMED_WAIT;
+                enterTimeWait(tcb);
+            }
+            break;
+
+        case ConnectionState::LAST_ACK:
+            tcb->acknowledge(ack_num);
+            if(ack_num == tcb->getSequence()){
+                tcb->state = ConnectionState::CLOSED;
+                finished = true;
+            }
+            break;
+        
+        default:
+            break;
+        }
+        tcb->conn_mutex.unlock();
+        tcb->bind_mutex.unlock();
+        if(finished){
+            tcb_mutex.lock();
+            tcbs.erase(tcb);
+            tcb_mutex.unlock();
+            conns.erase(tcb);
+            bitmap.bitmap_delete(change_order(tcb->src_port));
+            // The closing thread releases TCB.
+            sem_post(&tcb->fin_sem);
         }
-        tcb_mutex.unlock();
         break;
     
     case SegmentType::FIN:
         break;
     
     case SegmentType::FIN_ACK:
-        tcb_mutex.lock();
-        for(auto it: tcbs)
+        if(tcb == NULL){
+            break;
+        }
+        tcb->conn_mutex.lock();
+        // Data sent with the FIN comes before it.
+        if((rest_len != 0) && 
+           ((tcb->state == ConnectionState::ESTABLISHED) || 
+            (tcb->state == ConnectionState::FIN_WAIT1) || 
+            (tcb->state == ConnectionState::FIN_WAIT2)))
         {
-            it->conn_mutex.lock();
-            if((it->state == ConnectionState::ESTABLISHED) &&
-               (it->src_addr.s_addr == dst_addr.s_addr) && 
-               (it->src_port == tcp_header->dst_port) &&
-               (it->dst_addr.s_addr == src_addr.s_addr) &&
-               (it->dst_port == tcp_header->src_port))
-            {
-                if(seq != it->getAcknowledgement()){
-                    it->conn_mutex.unlock();
-                    break;
-                }
-                it->setAcknowledgement(seq + 1);
-                it->setDestWindow(window);
-                it->state = ConnectionState::CLOSE_WAIT;
-                it->conn_mutex.unlock();
-                sendSegment(it, SegmentType::ACK, NULL, 0);
-                break;
+            receiveData(tcb, seq, buf + header_len, rest_len, psh);
+        }
+        seq += rest_len;
+        if(tcb->state == ConnectionState::CLOSING){
+            // The FIN again, as our ACK of it was lost. It may acknowledge 
+            // ours too.
+            tcb->acknowledge(ack_num);
+            sendSegment(tcb, SegmentType::ACK, NULL, 0);
+            if(ack_num == tcb->getSequence()){
+                tcb->state = ConnectionState::TIMED_WAIT;
+                enterTimeWait(tcb);
             }
-            else if(((it->state == ConnectionState::FIN_WAIT1) || 
-                     (it->state == ConnectionState::FIN_WAIT2)) &&
-                    (it->src_addr.s_addr == dst_addr.s_addr) && 
-                    (it->src_port == tcp_header->dst_port) &&
-                    (it->dst_addr.s_addr == src_addr.s_addr) &&
-                    (it->dst_port == tcp_header->src_port))
-            {
-                if(seq != it->getAcknowledgement()){
-                    it->conn_mutex.unlock();
-                    break;
-                }
-                it->setAcknowledgement(seq + 1);
-                it->setDestWindow(window);
-                it->state = ConnectionState::TIMED_WAIT;
-                sendSegment(it, SegmentType::ACK, NULL, 0);
-                it->conn_mutex.unlock();
-                std::thread(&TransportLayer::timedWait, this, it).detach();
-                break;
+            tcb->conn_mutex.unlock();
+        }
+        else if(seq != tcb->getAcknowledgement()){
+            tcb->conn_mutex.unlock();
+        }
+        else if(listener != NULL){
+            // Connection not accepted yet
+            if(listener->received.count(tcb) == 0){
+                tcb->setAcknowledgement(seq + 1);
+                tcb->setDestWindow(window);
+                tcb->state = ConnectionState::CLOSE_WAIT;
+                sendSegment(tcb, SegmentType::ACK, NULL, 0);
             }
-            else if((it->state == ConnectionState::LISTEN) &&
-                    (it->src_addr.s_addr == dst_addr.s_addr) &&
-                    (it->src_port == tcp_header->dst_port))
+            tcb->conn_mutex.unlock();
+        }
+        else if(tcb->state == ConnectionState::ESTABLISHED){
+            // Data the FIN acknowledges leaves the queue and the flight.
+            processAck(tcb, ack_num, window, 0, sack_blocks, sack_cnt);
+            tcb->setAcknowledgement(seq + 1);
+            tcb->state = ConnectionState::CLOSE_WAIT;
+            sendSegment(tcb, SegmentType::ACK, NULL, 0);
+            tcb->conn_mutex.unlock();
+        }
+        else if((tcb->state == ConnectionState::FIN_WAIT1) || 
+                (tcb->state == ConnectionState::FIN_WAIT2))
+        {
+            // The ACK may cover our FIN, which then leaves the queue.
+            tcb->acknowledge(ack_num);
+            tcb->setAcknowledgement(seq + 1);
+            tcb->setDestWindow(window);
+            sendSegment(tcb, SegmentType::ACK, NULL, 0);
+            if((tcb->state == ConnectionState::FIN_WAIT2) || 
+               (ack_num == tcb->getSequence()))
             {
-                for(auto i: it->pending){
-                    if((i->dst_addr.s_addr == src_addr.s_addr) &&
-                       (i->dst_port == tcp_header->src_port))
-                    {
-                        flag = true;
-                        if(seq != i->getAcknowledgement()){
-                            break;
-                        }
-                        i->setAcknowledgement(seq + 1);
-                        i->setDestWindow(window);
-                        i->state = ConnectionState::CLOSE_WAIT;
-                        sendSegment(i, SegmentType::ACK, NULL, 0);
-                        break;
-                    }
-                }
-                it->conn_mutex.unlock();
+                tcb->state = ConnectionState::TIMED_WAIT;
+                enterTimeWait(tcb);
             }
             else{
-                it->conn_mutex.unlock();
-            }
-            if(flag){
-                break;
+                // Simultaneous close. Our FIN is still retransmitted until 
+                // it's acknowledged.
+                tcb->state = ConnectionState::CLOSING;
             }
+            tcb->conn_mutex.unlock();
+        }
+        else{
+            tcb->conn_mutex.unlock();
         }
-        tcb_mutex.unlock();
         break;
 
     default:
         break;
     }
+
+    if(listener != NULL){
+        listener->bind_mutex.unlock();
+        listener->release();
+    }
+    if(tcb != NULL){
+        tcb->release();
+    }
+    return true;
+}
+
+/**
+ * @brief Find the listening socket on PORT of address ADDR.
+ * 
+ * @return The TCB of the socket, or NULL if there is none. The caller 
+ * releases it.
+ */
+TCB * 
+TransportLayer::findListener(struct in_addr addr, u_short port)
+{
+    TCB *tcb = NULL;
+    listen_mutex.lock();
+    auto it = port2listener.find(port);
+    if((it != port2listener.end()) && 
+       (it->second->state == ConnectionState::LISTEN) &&
+       (it->second->src_addr.s_addr == addr.s_addr))
+    {
+        tcb = it->second;
+        tcb->hold();
+    }
+    listen_mutex.unlock();
+    return tcb;
+}
+
+/**
+ * @brief Take LEN bytes of DATA at sequence number SEQ received on TCB. 
+ * Data is trimmed to the receive window, and data received already is 
+ * dropped and reported in a D-SACK block. Data in order is written to the 
+ * window, followed by any data held out of order that it connects to, and 
+ * its ACK is delayed. Data out of order is held, and a duplicate ACK at 
+ * once tells the other end what's missing, as does an ACK of data filling 
+ * a hole or partly received already. The caller holds `conn_mutex`.
+ * 
+ * @return Whether the segment is acceptable, i.e., its acknowledgement 
+ * number is to be processed.
+ * 
+ * @see RFC793 3.3, RFC2883 & RFC5681 4.2
+ */
+bool 
+TransportLayer::receiveData(TCB *tcb, unsigned int seq, const u_char *data, 
+                            int len, bool psh)
+{
+    bool ack = false;
+    unsigned int rcv_nxt = tcb->getAcknowledgement();
+    unsigned int wnd = tcb->getWindow();
+    if(len == 0){
+        return (seq - rcv_nxt) <= wnd;
+    }
+    if(SEQ_LT(seq, rcv_nxt)){
+        unsigned int dup = std::min(rcv_nxt - seq, (unsigned int)len);
+        // Report the duplicate, so the other end can tell a spurious 
+        // retransmission.
+        tcb->dsack_pending = tcb->sack_ok;
+        tcb->dsack[0] = seq;
+        tcb->dsack[1] = seq + dup;
+        if(dup == (unsigned int)len){
+            sendSegment(tcb, SegmentType::ACK, NULL, 0);
+            return false;
+        }
+        seq += dup;
+        data += dup;
+        len -= dup;
+        ack = true;
+    }
+    if(seq - rcv_nxt >= wnd){
+        // Beyond the window, or a probe of a zero window
+        sendSegment(tcb, SegmentType::ACK, NULL, 0);
+        return false;
+    }
+    if(seq != rcv_nxt){
+        tcb->queueOutOfOrder(seq, data, len);
+        sendSegment(tcb, SegmentType::ACK, NULL, 0);
+        return true;
+    }
+    len = std::min((unsigned int)len, wnd);
+    tcb->setAcknowledgement(seq + len);
+    tcb->writeWindow(data, len, psh);
+    if(!tcb->ooo.empty()){
+        tcb->spliceOutOfOrder();
+        ack = true;
+    }
+    if(ack){
+        sendSegment(tcb, SegmentType::ACK, NULL, 0);
+    }
+    else{
+        delayAck(tcb, len, psh);
+    }
     return true;
 }
 
 /**
- * @brief Let TCB sleep for a while and clean up its resources.
+ * @brief Schedule the ACK of LEN bytes just received in order on TCB. The 
+ * ACK is delayed, so that it may be sent with data. Once two full-sized 
+ * segments are unacknowledged, or the data is pushed, it's sent at the end 
+ * of the receive batch instead, coalesced with ACKs of other segments in 
+ * the batch. The caller holds `conn_mutex`.
+ * 
+ * @see RFC1122 4.2.3.2 & RFC5681 4.2
+ */
+void 
+TransportLayer::delayAck(TCB *tcb, int len, bool psh)
+{
+    tcb->ack_bytes += len;
+    if(psh || (tcb->ack_bytes >= 2 * tcb->rcv_mss)){
+        if(!tcb->ack_queued){
+            tcb->ack_queued = true;
+            tcb->hold();
+            ack_mutex.lock();
+            ack_queue.push_back(tcb);
+            ack_mutex.unlock();
+        }
+    }
+    else{
+        tcb->armAckTimer(getTimeMicro() + DELAYED_ACK_TIME);
+    }
+}
+
+/**
+ * @brief Send the ACKs due at the end of a receive batch, unless they have 
+ * been sent with data meanwhile. Called by the receiving thread after it 
+ * processes a batch of frames.
+ */
+void 
+TransportLayer::flushAcks()
+{
+    std::vector<TCB *> queue;
+    ack_mutex.lock();
+    queue.swap(ack_queue);
+    ack_mutex.unlock();
+    for(auto tcb: queue){
+        tcb->conn_mutex.lock();
+        tcb->ack_queued = false;
+        if((tcb->ack_bytes != 0) && 
+           (tcb->state != ConnectionState::CLOSED))
+        {
+            sendSegment(tcb, SegmentType::ACK, NULL, 0);
+        }
+        tcb->conn_mutex.unlock();
+        tcb->release();
+    }
+}
+
+/**
+ * @brief Send the ACK delayed on TCB, as `ack_timer` expires.
+ */
+void 
+TransportLayer::handleAckTimer(TCB *tcb)
+{
+    tcb->conn_mutex.lock();
+    if(!TCB::getTimers().isArmed(&tcb->ack_timer) && (tcb->ack_bytes != 0) && 
+       (tcb->state != ConnectionState::CLOSED))
+    {
+        sendSegment(tcb, SegmentType::ACK, NULL, 0);
+    }
+    tcb->conn_mutex.unlock();
+}
+
+/**
+ * @brief Process the acknowledgement number ACK_NUM, window WINDOW and N 
+ * SACK BLOCKS of a segment with REST_LEN bytes of data on a synchronized 
+ * connection. `DUPACK_THRESHOLD` duplicate ACKs retransmit the first 
+ * segment unacknowledged and start fast recovery. Without SACK, each 
+ * further duplicate inflates the window by a segment, and each partial ACK 
+ * retransmits the next hole. With SACK, segments are also deemed lost by 
+ * RACK, and only those deemed lost by the scoreboard are retransmitted, as 
+ * the pipe allows. An ACK beyond a tail loss probe tells whether it 
+ * repaired a loss. The caller holds `conn_mutex`.
+ * 
+ * @see RFC5681 3.2, RFC6582, RFC6675 & RFC8985
  */
 void 
-TransportLayer::timedWait(TCB *tcb)
+TransportLayer::processAck(TCB *tcb, unsigned int ack_num, u_short window, 
+                           int rest_len, const unsigned int blocks[][2], 
+                           int n)
 {
-    std::this_thread::sleep_for(std::chrono::milliseconds(2 * tcb->srtt));
+    bool window_update = window != tcb->getDestWindow();
+    tcb->setDestWindow(window);
+    if(window_update){
+        tcb->send_cond.notify_all();
+    }
+    // A first block below the ACK reports a duplicate(D-SACK, RFC2883).
+    bool dsack = (n != 0) && !SEQ_LT(ack_num, blocks[0][1]);
+    bool sacked = tcb->sack_ok && (n != 0) && 
+                  tcb->updateScoreboard(blocks, n);
+    if(tcb->tlp_active){
+        if(dsack){
+            // Both the probe and the original arrived. Nothing was lost.
+            tcb->tlp_active = false;
+        }
+        else if(SEQ_LT(tcb->tlp_end, ack_num)){
+            // The probe repaired a loss, which calls for a congestion 
+            // response.
+            tcb->tlp_active = false;
+            if(!tcb->in_recovery){
+                tcb->cc->onLoss(&tcb->cong, LossType::FAST_RETRANSMIT);
+            }
+        }
+    }
+    if(ack_num != tcb->getSndUna()){
+        if(tcb->acknowledge(ack_num) != 0){
+            tcb->dupacks = 0;
+            if(!tcb->in_recovery){
+                if(tcb->sack_ok && ((int)(ack_num - tcb->recover) > 0) && 
+                   tcb->markLost(false))
+                {
+                    enterRecovery(tcb);
+                }
+                else if(tcb->lost_bytes != 0){
+                    // Go back N after a timeout.
+                    retransmitLost(tcb, false);
+                }
+            }
+            else if(tcb->sack_ok){
+                tcb->markLost(true);
+                retransmitLost(tcb, false);
+            }
+            else{
+                retransmitFirst(tcb);
+            }
+        }
+        return;
+    }
+    if((rest_len != 0) || window_update || (tcb->cong.inflight == 0)){
+        return;
+    }
+
+    tcb->dupacks++;
+    if(tcb->in_recovery){
+        // Each duplicate means another segment has left the network. With 
+        // SACK, the pipe shrinks by the segments sacked.
+        if(tcb->sack_ok){
+            if(sacked){
+                tcb->markLost(false);
+                retransmitLost(tcb, false);
+            }
+        }
+        else{
+            tcb->cong.cwnd += tcb->cong.mss;
+        }
+        tcb->send_cond.notify_all();
+    }
+    else if(((int)(ack_num - tcb->recover) > 0) && 
+            ((tcb->dupacks >= DUPACK_THRESHOLD) || 
+             (sacked && tcb->markLost(false))))
+    {
+        enterRecovery(tcb);
+    }
+}
+
+/**
+ * @brief Start fast recovery on TCB, and retransmit the first segment 
+ * unacknowledged. The caller holds `conn_mutex`.
+ */
+void 
+TransportLayer::enterRecovery(TCB *tcb)
+{
+    CongestionState &cong = tcb->cong;
+    tcb->in_recovery = true;
+    tcb->recover = tcb->getSequence();
+    tcb->cc->onLoss(&cong, LossType::FAST_RETRANSMIT);
+    if(tcb->sack_ok){
+        tcb->markLost(true);
+        retransmitLost(tcb, true);
+    }
+    else{
+        // The segments that triggered the duplicates have left the network.
+        cong.cwnd += DUPACK_THRESHOLD * cong.mss;
+        retransmitFirst(tcb);
+    }
+}
+
+/**
+ * @brief Retransmit the segment E of TCB. The caller holds `retrans_mutex`.
+ */
+void 
+TransportLayer::retransmit(TCB *tcb, RetransElem *e)
+{
+    e->retransmitted = true;
+    e->xmit_time = getTimeMicro();
+    network_layer->sendIPPacket(tcb->src_addr, tcb->dst_addr, IPPROTO_TCP, 
+                                e->segment + SIZE_PSEUDO, e->len, 
+                                DEFAULT_TTL, tcb->tos);
+}
+
+/**
+ * @brief Retransmit the first segment unacknowledged on TCB.
+ */
+void 
+TransportLayer::retransmitFirst(TCB *tcb)
+{
+    tcb->retrans_mutex.lock();
+    if(!tcb->retrans_list.empty()){
+        retransmit(tcb, tcb->retrans_list.front());
+    }
+    tcb->retrans_mutex.unlock();
+}
+
+/**
+ * @brief Retransmit the segments on TCB deemed lost and not retransmitted 
+ * yet, in order, while the pipe is below the congestion window. If FORCE, 
+ * the first one is retransmitted regardless. The caller holds `conn_mutex`.
+ * 
+ * @see RFC6675 5
+ */
+void 
+TransportLayer::retransmitLost(TCB *tcb, bool force)
+{
+    tcb->retrans_mutex.lock();
+    for(auto e: tcb->retrans_list){
+        if(!force && (tcb->getPipe() >= tcb->cong.cwnd)){
+            break;
+        }
+        if(!e->lost || e->resent){
+            continue;
+        }
+        e->resent = true;
+        tcb->resent_bytes += e->end - e->seq;
+        force = false;
+        retransmit(tcb, e);
+    }
+    tcb->retrans_mutex.unlock();
+}
+
+/**
+ * @brief Handle the expiry of `loss_timer` of TCB. If it waited for 
+ * reordering, segments whose reordering window has passed are deemed lost 
+ * and retransmitted, starting recovery if needed. If it's for a tail loss 
+ * probe, the last segment sent is retransmitted to draw an ACK revealing 
+ * any loss before the RTO, which is restarted.
+ * 
+ * @see RFC8985 6.3 & 7.3
+ */
+void 
+TransportLayer::handleLossTimer(TCB *tcb)
+{
+    int64_t now = getTimeMicro();
+    tcb->conn_mutex.lock();
+    tcb->retrans_mutex.lock();
+    bool idle = TCB::getTimers().isArmed(&tcb->loss_timer) || 
+                tcb->retrans_list.empty() || 
+                (tcb->state == ConnectionState::CLOSED);
+    if(idle){
+        // Re-armed or cancelled in the meantime
+    }
+    else if(!tcb->probe_timer){
+        tcb->retrans_mutex.unlock();
+        if(tcb->sack_ok && tcb->markLost(false)){
+            if(tcb->in_recovery){
+                retransmitLost(tcb, false);
+            }
+            else if((int)(tcb->getSndUna() - tcb->recover) > 0){
+                enterRecovery(tcb);
+            }
+        }
+        tcb->retrans_mutex.lock();
+        tcb->armProbeTimer(now);
+    }
+    else if(tcb->in_recovery || tcb->tlp_active){
+        // Recovery is under way.
+    }
+    else if(!network_layer->isWritable(tcb->dst_addr)){
+        tcb->armLossTimer(now + RETRANS_TICK * 1000);
+    }
+    else{
+        retransmit(tcb, tcb->retrans_list.back());
+        tcb->tlp_active = true;
+        tcb->tlp_end = tcb->getSequence();
+        tcb->armRetransTimer(now + tcb->getRTO());
+    }
+    tcb->retrans_mutex.unlock();
+    tcb->conn_mutex.unlock();
+}
+
+/**
+ * @brief Abort the connection of TCB with ERROR, e.g., as retransmissions 
+ * time out. Data outstanding is dropped, and threads waiting on the 
+ * connection are woken to report ERROR. A connection not accepted yet is 
+ * forgotten by its listening socket. If the descriptor is closed already, 
+ * the closing thread is woken to release TCB, and otherwise `_close` 
+ * does. The caller holds a reference to TCB and none of its locks.
+ */
+void 
+TransportLayer::abortConnection(TCB *tcb, int error)
+{
+    tcb->conn_mutex.lock();
+    TCB *listener = tcb->listener;
+    if(listener != NULL){
+        listener->hold();
+    }
+    tcb->conn_mutex.unlock();
+    if(listener != NULL){
+        listener->bind_mutex.lock();
+        bool forgotten = listener->received.erase(tcb) != 0;
+        listener->bind_mutex.unlock();
+        if(forgotten){
+            conns.erase(tcb);
+            tcb->conn_mutex.lock();
+            tcb->listener = NULL;
+            tcb->state = ConnectionState::CLOSED;
+            tcb->discardOutstanding();
+            tcb->conn_mutex.unlock();
+            listener->release();
+            tcb->release();
+        }
+        listener->release();
+        if(forgotten){
+            return;
+        }
+    }
+
+    tcb->conn_mutex.lock();
+    ConnectionState::ConnectionState state = tcb->state;
+    bool orphan = tcb->closed;
+    tcb->discardOutstanding();
+    if((state == ConnectionState::CLOSED) || 
+       (state == ConnectionState::TIMED_WAIT))
+    {
+        tcb->conn_mutex.unlock();
+        return;
+    }
+    tcb->state = ConnectionState::CLOSED;
+    tcb->error = error;
+    tcb->send_cond.notify_all();
+    tcb->conn_mutex.unlock();
+    tcb_mutex.lock();
+    tcbs.erase(tcb);
+    tcb_mutex.unlock();
+    conns.erase(tcb);
+    if(state == ConnectionState::SYN_SENT){
+        // `_connect` cleans up.
+        sem_post(&tcb->semaphore);
+    }
+    else if(orphan){
+        bitmap.bitmap_delete(change_order(tcb->src_port));
+        sem_post(&tcb->fin_sem);
+    }
+}
+
+/**
+ * @brief Move the connection of TCB into TIME-WAIT, and let the closing 
+ * thread release TCB. Its local port stays in use until TIME-WAIT ends. 
+ * The caller holds its `conn_mutex`.
+ */
+void 
+TransportLayer::enterTimeWait(TCB *tcb)
+{
+    // Insert the entry before the TCB is erased, so that no segment of the 
+    // connection is taken for a new one in between.
+    time_wait.insert(tcb, getTimeMicro() + TIME_WAIT_TIME);
+    // Nothing is retransmitted in TIME-WAIT, and no timer may keep TCB.
+    tcb->discardOutstanding();
     tcb_mutex.lock();
     tcbs.erase(tcb);
     tcb_mutex.unlock();
-    bitmap.bitmap_delete(change_order(tcb->src_port));
+    conns.erase(tcb);
     sem_post(&tcb->fin_sem);
-    return;
 }
 
 /**
- * @brief Retransmission
+ * @brief Handle a segment of a connection that may be in TIME-WAIT. A 
+ * retransmitted FIN is acknowledged again and restarts TIME-WAIT, and a 
+ * SYN with a sequence number above the last one of the old connection 
+ * ends it early, so that a new connection can reuse the 4-tuple. RSTs are 
+ * ignored(RFC1337).
+ * 
+ * @return true if the segment is consumed, false if the connection isn't 
+ * in TIME-WAIT or the SYN may open a new one.
+ * 
+ * @see RFC793 & RFC1122 4.2.2.13
+ */
+bool 
+TransportLayer::handleTimeWait(SegmentType::SegmentType type, 
+                               unsigned int seq, struct in_addr local_addr, 
+                               u_short local_port, 
+                               struct in_addr remote_addr, 
+                               u_short remote_port)
+{
+    TimeWaitEntry entry;
+    if(!time_wait.find(local_addr, local_port, remote_addr, remote_port, 
+                       &entry))
+    {
+        return false;
+    }
+    switch (type)
+    {
+    case SegmentType::SYN:
+        if(((int)(seq - entry.rcv_nxt) > 0) && time_wait.erase(entry.key)){
+            // The old connection ends, and so does its use of the port.
+            bitmap.bitmap_delete(change_order(local_port));
+            return false;
+        }
+        sendTimeWaitAck(entry);
+        break;
+
+    case SegmentType::FIN:
+    case SegmentType::FIN_ACK:
+        sendTimeWaitAck(entry);
+        time_wait.restart(entry.key, getTimeMicro() + TIME_WAIT_TIME);
+        break;
+
+    default:
+        break;
+    }
+    return true;
+}
+
+/**
+ * @brief Acknowledge the FIN of the other end for a connection in 
+ * TIME-WAIT.
+ * 
+ * @return `true` on success, `false` on error.
+ */
+bool 
+TransportLayer::sendTimeWaitAck(const TimeWaitEntry &entry)
+{
+    u_char segment[SIZE_PSEUDO + SIZE_TCP];
+    PseudoHeader *pseudo_header = (PseudoHeader *)segment;
+    TCPHeader *tcp_header = (TCPHeader *)(segment + SIZE_PSEUDO);
+    pseudo_header->src_addr.s_addr = entry.key.local_addr;
+    pseudo_header->dst_addr.s_addr = entry.key.remote_addr;
+    pseudo_header->zero = 0;
+    pseudo_header->protocol = IPPROTO_TCP;
+    pseudo_header->length = change_order((u_short)SIZE_TCP);
+    tcp_header->src_port = entry.key.local_port;
+    tcp_header->dst_port = entry.key.remote_port;
+    tcp_header->seq = change_order(entry.snd_nxt);
+    tcp_header->ack = change_order(entry.rcv_nxt);
+    tcp_header->data_off = DEFAULT_OFF;
+    tcp_header->ctl_bits = ControlBits::ACK;
+    tcp_header->window = 0;
+    tcp_header->checksum = 0;
+    tcp_header->urgent = 0;
+    tcp_header->checksum = calculate_checksum(segment, sizeof(segment));
+
+    int rc = network_layer->sendIPPacket(pseudo_header->src_addr, 
+                                         pseudo_header->dst_addr, 
+                                         IPPROTO_TCP, 
+                                         segment + SIZE_PSEUDO, SIZE_TCP, 
+                                         DEFAULT_TTL, entry.tos);
+    if(rc == -1){
+        std::cerr << "Send segment error!" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Retransmission. Each connection has a timer covering its oldest 
+ * unacknowledged segment. When it expires, the segment is retransmitted 
+ * and the timer is backed off, and the rest of the flight is deemed lost, 
+ * to be retransmitted as ACKs arrive. Timers live in a timing wheel, so only 
+ * connections whose timers expire are visited. Loss timers of RACK-TLP, 
+ * delayed ACKs and TIME-WAIT are handled here too.
+ * 
+ * @see RFC6298 5
  */
 void 
 TransportLayer::updateRetrans()
 {
+    std::vector<TimerNode *> expired;
+    std::vector<ConnKey> time_waits;
+    TimerWheel &timers = TCB::getTimers();
     while(true) {
-        std::this_thread::sleep_for(std::chrono::milliseconds(5));
-        tcb_mutex.lock();
-        for(auto tcb: tcbs){
+        std::this_thread::sleep_for(std::chrono::milliseconds(RETRANS_TICK));
+        int64_t now = getTimeMicro();
+        // Local ports of connections are released as TIME-WAIT ends.
+        time_wait.expire(now, time_waits);
+        for(auto &key: time_waits){
+            bitmap.bitmap_delete(change_order(key.local_port));
+        }
+        time_waits.clear();
+
+        timers.advance(now, expired);
+        // Each expired timer holds a reference to its TCB.
+        for(auto node: expired){
+            TCB *tcb = (TCB *)node->owner;
+            bool timeout = false;
+            if(node == &tcb->loss_timer){
+                handleLossTimer(tcb);
+                tcb->release();
+                continue;
+            }
+            if(node == &tcb->ack_timer){
+                handleAckTimer(tcb);
+                tcb->release();
+                continue;
+            }
+            bool give_up = false;
+            bool first_timeout = false;
             tcb->retrans_mutex.lock();
-            for(auto it = tcb->retrans_list.begin(); 
-                it != tcb->retrans_list.end(); ) 
+            if(timers.isArmed(node) || tcb->retrans_list.empty()){
+                // Re-armed or cancelled on an ACK in the meantime
+            }
+            else if((tcb->state == ConnectionState::CLOSED) || 
+                    (tcb->backoff >= MAX_RETRIES))
             {
-                RetransElem *e = *it;
-                if(e->seq < tcb->getSndUna()){
-                    delete e;
-                    it = tcb->retrans_list.erase(it);
+                give_up = true;
+            }
+            else if(!network_layer->isWritable(tcb->dst_addr)){
+                tcb->armRetransTimer(now + RETRANS_TICK * 1000);
+            }
+            else{
+                timeout = true;
+                first_timeout = tcb->backoff == 0;
+                retransmit(tcb, tcb->retrans_list.front());
+                tcb->backoff++;
+                tcb->armRetransTimer(now + tcb->getRTO());
+            }
+            tcb->retrans_mutex.unlock();
+            // `retrans_mutex` is released first, as `conn_mutex` is taken 
+            // before it elsewhere.
+            if(give_up){
+                abortConnection(tcb, ETIMEDOUT);
+            }
+            if(timeout){
+                // Leave fast recovery, and don't start it again on 
+                // duplicate ACKs of data sent before the timeout(RFC6582 4).
+                // Repeated timeouts of the same data don't reduce 
+                // `ssthresh` again, and only restart slow start(RFC5681 
+                // 3.1).
+                tcb->conn_mutex.lock();
+                if(first_timeout){
+                    tcb->cc->onLoss(&tcb->cong, LossType::RTO);
                 }
                 else{
-                    e->time++;
-                    if(e->time == RETRANS_TIME){
-                        e->time = 0;
-                        network_layer->sendIPPacket(tcb->src_addr, 
-                                                    tcb->dst_addr, IPPROTO_TCP, 
-                                                    e->segment + SIZE_PSEUDO, 
-                                                    e->len);
-                    }
-                    it++;
+                    tcb->cong.cwnd = tcb->cong.mss;
                 }
+                tcb->markAllLost(now);
+                tcb->tlp_active = false;
+                tcb->in_recovery = false;
+                tcb->dupacks = 0;
+                tcb->recover = tcb->getSequence();
+                tcb->conn_mutex.unlock();
             }
-            tcb->retrans_mutex.unlock();
+            tcb->release();
         }
-        tcb_mutex.unlock();
+        expired.clear();
     }
     return;
 }
\ No newline at end of file
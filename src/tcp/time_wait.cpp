@@ -0,0 +1,130 @@
+/**
+ * @file time_wait.cpp
+ */
+
+#include <tcp/time_wait.h>
+#include <tcp/segment.h>
+
+TimeWaitTable::TimeWaitTable(): entries(), timers(RETRANS_TICK * 1000) {}
+
+TimeWaitTable::~TimeWaitTable()
+{
+    for(auto &i: entries){
+        delete i.second;
+    }
+}
+
+/**
+ * @brief Remove ENTRY, whose timer isn't armed. The caller holds `mutex`.
+ */
+void 
+TimeWaitTable::remove(TimeWaitEntry *entry)
+{
+    entries.erase(entry->key);
+    delete entry;
+}
+
+/**
+ * @brief Put the connection of TCB into TIME-WAIT until EXPIRES(in
+ * microseconds). The caller holds its `conn_mutex`.
+ */
+void 
+TimeWaitTable::insert(TCB *tcb, int64_t expires)
+{
+    TimeWaitEntry *entry = new TimeWaitEntry();
+    entry->key = ConnTable::makeKey(tcb);
+    entry->snd_nxt = tcb->getSequence();
+    entry->rcv_nxt = tcb->getAcknowledgement();
+    entry->tos = tcb->tos;
+    entry->timer.owner = entry;
+    mutex.lock();
+    auto it = entries.find(entry->key);
+    if(it != entries.end()){
+        timers.cancel(&it->second->timer);
+        remove(it->second);
+    }
+    entries.emplace(entry->key, entry);
+    timers.arm(&entry->timer, expires);
+    mutex.unlock();
+}
+
+/**
+ * @brief Find the connection by its 4-tuple. Ports are in network byte
+ * order.
+ *
+ * @param entry Set to a copy of the entry if found.
+ * @return true if it's in TIME-WAIT.
+ */
+bool 
+TimeWaitTable::find(struct in_addr local_addr, u_short local_port,
+                    struct in_addr remote_addr, u_short remote_port,
+                    TimeWaitEntry *entry)
+{
+    ConnKey key;
+    key.local_addr = local_addr.s_addr;
+    key.remote_addr = remote_addr.s_addr;
+    key.local_port = local_port;
+    key.remote_port = remote_port;
+    bool found = false;
+    mutex.lock();
+    auto it = entries.find(key);
+    if(it != entries.end()){
+        *entry = *it->second;
+        found = true;
+    }
+    mutex.unlock();
+    return found;
+}
+
+/**
+ * @brief End TIME-WAIT of the connection KEY early.
+ *
+ * @return true if it was in TIME-WAIT.
+ */
+bool 
+TimeWaitTable::erase(const ConnKey &key)
+{
+    bool found = false;
+    mutex.lock();
+    auto it = entries.find(key);
+    if(it != entries.end()){
+        timers.cancel(&it->second->timer);
+        remove(it->second);
+        found = true;
+    }
+    mutex.unlock();
+    return found;
+}
+
+/**
+ * @brief Restart TIME-WAIT of the connection KEY to end at EXPIRES(in
+ * microseconds).
+ */
+void 
+TimeWaitTable::restart(const ConnKey &key, int64_t expires)
+{
+    mutex.lock();
+    auto it = entries.find(key);
+    if(it != entries.end()){
+        timers.arm(&it->second->timer, expires);
+    }
+    mutex.unlock();
+}
+
+/**
+ * @brief Remove the entries expired by NOW(in microseconds), and append
+ * their 4-tuples to EXPIRED.
+ */
+void 
+TimeWaitTable::expire(int64_t now, std::vector<ConnKey> &expired)
+{
+    std::vector<TimerNode *> nodes;
+    mutex.lock();
+    timers.advance(now, nodes);
+    for(auto node: nodes){
+        TimeWaitEntry *entry = (TimeWaitEntry *)node->owner;
+        expired.push_back(entry->key);
+        remove(entry);
+    }
+    mutex.unlock();
+}
@@ -0,0 +1,158 @@
+/**
+ * @file timer_wheel.cpp
+ */
+
+#include <tcp/timer_wheel.h>
+#include <chrono>
+
+TimerNode::TimerNode(void *o): prev(NULL), next(NULL), expires(0), owner(o)
+{}
+
+/**
+ * @brief Constructor of `TimerWheel`.
+ *
+ * @param tick Microseconds per tick, the granularity of timers.
+ */
+TimerWheel::TimerWheel(int64_t tick): tick_us(tick), slots()
+{
+    auto duration = std::chrono::high_resolution_clock::now()
+                    .time_since_epoch();
+    current = std::chrono::duration_cast<std::chrono::microseconds>(duration)
+              .count() / tick_us;
+    for(int i = 0; i < WHEEL_LEVELS; i++){
+        for(int j = 0; j < WHEEL_SLOTS; j++){
+            slots[i][j].prev = slots[i][j].next = &slots[i][j];
+        }
+    }
+}
+
+/**
+ * @brief Put NODE into the slot of its expiry time. Timers within
+ * WHEEL_SLOTS ticks go to the lowest level, those within WHEEL_SLOTS^2
+ * ticks to the next one, and so on. Expired ones go to the current slot.
+ */
+void 
+TimerWheel::place(TimerNode *node)
+{
+    int64_t delta = node->expires - current;
+    TimerNode *head;
+    if(delta < 0){
+        head = &slots[0][current & WHEEL_MASK];
+    }
+    else{
+        int level = 0;
+        while((level < WHEEL_LEVELS - 1) &&
+              (delta >> (WHEEL_BITS * (level + 1)) != 0))
+        {
+            level++;
+        }
+        if(delta >> (WHEEL_BITS * WHEEL_LEVELS) != 0){
+            node->expires = current +
+                            ((int64_t)1 << (WHEEL_BITS * WHEEL_LEVELS)) - 1;
+        }
+        int index = (node->expires >> (WHEEL_BITS * level)) & WHEEL_MASK;
+        head = &slots[level][index];
+    }
+    node->prev = head->prev;
+    node->next = head;
+    head->prev->next = node;
+    head->prev = node;
+}
+
+void 
+TimerWheel::unlink(TimerNode *node)
+{
+    node->prev->next = node->next;
+    node->next->prev = node->prev;
+    node->prev = node->next = NULL;
+}
+
+/**
+ * @brief Move the timers of a slot in a higher level down to where they
+ * belong now.
+ */
+void 
+TimerWheel::cascade(int level, int index)
+{
+    TimerNode *head = &slots[level][index];
+    TimerNode *node = head->next;
+    head->prev = head->next = head;
+    while(node != head){
+        TimerNode *next = node->next;
+        place(node);
+        node = next;
+    }
+}
+
+/**
+ * @brief Arm NODE to expire at EXPIRES(in microseconds), or re-arm it.
+ *
+ * @return true if it was already armed.
+ */
+bool 
+TimerWheel::arm(TimerNode *node, int64_t expires)
+{
+    mutex.lock();
+    bool armed = node->next != NULL;
+    if(armed){
+        unlink(node);
+    }
+    // Round up, so that it never expires early.
+    node->expires = (expires + tick_us - 1) / tick_us;
+    place(node);
+    mutex.unlock();
+    return armed;
+}
+
+/**
+ * @brief Cancel NODE.
+ *
+ * @return true if it was armed.
+ */
+bool 
+TimerWheel::cancel(TimerNode *node)
+{
+    mutex.lock();
+    bool armed = node->next != NULL;
+    if(armed){
+        unlink(node);
+    }
+    mutex.unlock();
+    return armed;
+}
+
+bool 
+TimerWheel::isArmed(TimerNode *node)
+{
+    mutex.lock();
+    bool armed = node->next != NULL;
+    mutex.unlock();
+    return armed;
+}
+
+/**
+ * @brief Process the ticks up to NOW(in microseconds), and append timers
+ * expired to EXPIRED. They're no longer armed.
+ */
+void 
+TimerWheel::advance(int64_t now, std::vector<TimerNode *> &expired)
+{
+    int64_t tick = now / tick_us;
+    mutex.lock();
+    while(current <= tick){
+        int index = current & WHEEL_MASK;
+        // Each time a level wraps around, a slot of the next one is due.
+        for(int level = 1; (index == 0) && (level < WHEEL_LEVELS); level++){
+            index = (current >> (WHEEL_BITS * level)) & WHEEL_MASK;
+            cascade(level, index);
+        }
+        TimerNode *head = &slots[0][current & WHEEL_MASK];
+        while(head->next != head){
+            TimerNode *node = head->next;
+            unlink(node);
+            expired.push_back(node);
+        }
+        current++;
+    }
+    mutex.unlock();
+}
@@ -0,0 +1,453 @@
+/**
+ * @file udp.cpp
+ */
+
+#include <ethernet/endian.h>
+#include <tcp/real_socket.h>
+#include <tcp/tcp.h>
+#include <tcp/udp.h>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+
+UDPQueue::UDPQueue(): head(0), tail(0)
+{
+}
+
+/**
+ * @brief Append a datagram to the queue. Only called on the receive path, 
+ * which holds `EpollServer::rx_mutex`, so there's a single producer even 
+ * when application threads busy-poll.
+ *
+ * @return false if the queue is full.
+ */
+bool 
+UDPQueue::push(const u_char *buf, int len, struct in_addr src_addr,
+               u_short src_port)
+{
+    unsigned int t = tail.load(std::memory_order_relaxed);
+    if(t - head.load(std::memory_order_acquire) == UDP_QUEUE_LEN){
+        return false;
+    }
+    UDPDatagram &slot = slots[t & (UDP_QUEUE_LEN - 1)];
+    if(slot.data.size() < (size_t)len){
+        slot.data.resize(len);
+    }
+    memcpy(slot.data.data(), buf, len);
+    slot.len = len;
+    slot.src_addr = src_addr;
+    slot.src_port = src_port;
+    tail.store(t + 1, std::memory_order_release);
+    return true;
+}
+
+/**
+ * @brief Get the first datagram in the queue, NULL if it's empty. It stays
+ * valid until `pop`.
+ */
+UDPDatagram * 
+UDPQueue::front()
+{
+    unsigned int h = head.load(std::memory_order_relaxed);
+    if(h == tail.load(std::memory_order_acquire)){
+        return NULL;
+    }
+    return &slots[h & (UDP_QUEUE_LEN - 1)];
+}
+
+/**
+ * @brief Remove the first datagram, returning its slot to the producer.
+ */
+void 
+UDPQueue::pop()
+{
+    unsigned int h = head.load(std::memory_order_relaxed);
+    head.store(h + 1, std::memory_order_release);
+}
+
+UDPSocket::UDPSocket():
+    src_addr({0}), src_port(0), dst_addr({0}), dst_port(0), bound(false),
+    connected(false), closed(false), tos(0), busy_poll(0), users(0),
+    drops(0)
+{
+    sem_init(&semaphore, 0, 0);
+}
+
+UDPSocket::~UDPSocket()
+{
+    sem_destroy(&semaphore);
+}
+
+/**
+ * @brief Find the UDP socket of FD and hold it so that it isn't deleted
+ * until `releaseUDP`.
+ *
+ * @return NULL if FD isn't a UDP socket.
+ */
+UDPSocket * 
+TransportLayer::acquireUDP(int fd)
+{
+    UDPSocket *udp = NULL;
+    udp_mutex.lock();
+    auto it = fd2udp.find(fd);
+    if(it != fd2udp.end()){
+        udp = it->second;
+        udp->users++;
+    }
+    udp_mutex.unlock();
+    return udp;
+}
+
+/**
+ * @brief Release a socket held by `acquireUDP`, deleting it if it has been
+ * closed and this is its last user.
+ */
+void 
+TransportLayer::releaseUDP(UDPSocket *udp)
+{
+    udp_mutex.lock();
+    udp->users--;
+    bool last = udp->closed && (udp->users == 0);
+    udp_mutex.unlock();
+    if(last){
+        delete udp;
+    }
+}
+
+/**
+ * @brief Bind a UDP socket to a local address and port. An ephemeral port
+ * is chosen if PORT is 0.
+ *
+ * @return 0 on success, -1 on error with errno set.
+ * @note The caller must hold `bind_mutex` of the socket.
+ */
+int 
+TransportLayer::bindUDP(UDPSocket *udp, struct in_addr addr, u_short port)
+{
+    if(udp->bound){
+        errno = EINVAL;
+        return -1;
+    }
+    if((addr.s_addr != INADDR_ANY) && !network_layer->findIP(addr)){
+        errno = EADDRNOTAVAIL;
+        return -1;
+    }
+
+    udp_mutex.lock();
+    if(port == 0){
+        for(int i = PORT_BEGIN; i < PORT_END; i++){
+            u_short candidate = change_order(next_udp_port);
+            next_udp_port = (next_udp_port + 1 == PORT_END) ?
+                            PORT_BEGIN : next_udp_port + 1;
+            if(port2udp.find(candidate) == port2udp.end()){
+                port = candidate;
+                break;
+            }
+        }
+        if(port == 0){
+            udp_mutex.unlock();
+            errno = EADDRINUSE;
+            return -1;
+        }
+    }
+    else if(port2udp.find(port) != port2udp.end()){
+        udp_mutex.unlock();
+        errno = EADDRINUSE;
+        return -1;
+    }
+    port2udp[port] = udp;
+    udp->src_addr = addr;
+    udp->src_port = port;
+    udp->bound = true;
+    udp_mutex.unlock();
+    return 0;
+}
+
+/**
+ * @brief Close a UDP socket. Threads blocked in `recvfrom` on it return
+ * with EBADF, and the last thread using it deletes it.
+ *
+ * @return 0 on success, -1 if FD isn't a UDP socket.
+ */
+int 
+TransportLayer::closeUDP(int fd)
+{
+    udp_mutex.lock();
+    auto it = fd2udp.find(fd);
+    if(it == fd2udp.end()){
+        udp_mutex.unlock();
+        return -1;
+    }
+    UDPSocket *udp = it->second;
+    fd2udp.erase(it);
+    if(udp->bound){
+        port2udp.erase(udp->src_port);
+    }
+    fds.retractUDP(fd);
+    __real_close(fd);
+    udp->closed = true;
+    bool last = (udp->users == 0);
+    for(int i = 0; i < udp->users; i++){
+        sem_post(&udp->semaphore);
+    }
+    udp_mutex.unlock();
+    if(last){
+        delete udp;
+    }
+    return 0;
+}
+
+/**
+ * @brief Send a datagram on a UDP socket. It's sent to DEST_ADDR, or to the
+ * address the socket is connected to if DEST_ADDR is NULL. An unbound socket
+ * is bound to an ephemeral port first.
+ *
+ * @note FLAGS are ignored.
+ */
+ssize_t 
+TransportLayer::_sendto(int socket, const void *message, size_t length,
+                        int flags, const struct sockaddr *dest_addr,
+                        socklen_t dest_len)
+{
+    UDPSocket *udp = acquireUDP(socket);
+    if(udp == NULL){
+        return __real_sendto(socket, message, length, flags,
+                             dest_addr, dest_len);
+    }
+
+    struct in_addr dst_addr;
+    u_short dst_port;
+    udp->bind_mutex.lock();
+    if(dest_addr != NULL){
+        const struct sockaddr_in *addr = (const struct sockaddr_in *)dest_addr;
+        if(dest_len < sizeof(struct sockaddr_in)){
+            udp->bind_mutex.unlock();
+            releaseUDP(udp);
+            errno = EINVAL;
+            return -1;
+        }
+        if(addr->sin_family != AF_INET){
+            udp->bind_mutex.unlock();
+            releaseUDP(udp);
+            errno = EAFNOSUPPORT;
+            return -1;
+        }
+        dst_addr = addr->sin_addr;
+        dst_port = addr->sin_port;
+    }
+    else if(udp->connected){
+        dst_addr = udp->dst_addr;
+        dst_port = udp->dst_port;
+    }
+    else{
+        udp->bind_mutex.unlock();
+        releaseUDP(udp);
+        errno = EDESTADDRREQ;
+        return -1;
+    }
+    if(length > MAX_UDP_DATA){
+        udp->bind_mutex.unlock();
+        releaseUDP(udp);
+        errno = EMSGSIZE;
+        return -1;
+    }
+    if(!udp->bound){
+        struct in_addr any;
+        any.s_addr = INADDR_ANY;
+        if(bindUDP(udp, any, 0) == -1){
+            udp->bind_mutex.unlock();
+            releaseUDP(udp);
+            return -1;
+        }
+    }
+    struct in_addr src_addr = udp->src_addr;
+    if(src_addr.s_addr == INADDR_ANY){
+        src_addr = network_layer->getIP();
+    }
+    u_short src_port = udp->src_port;
+    u_char tos = udp->tos;
+    udp->bind_mutex.unlock();
+
+    int total_len = SIZE_PSEUDO + SIZE_UDP + length;
+    u_char *datagram = new u_char[total_len];
+    memcpy(datagram + SIZE_PSEUDO + SIZE_UDP, message, length);
+    PseudoHeader *pseudo_header = (PseudoHeader *)datagram;
+    UDPHeader *udp_header = (UDPHeader *)(datagram + SIZE_PSEUDO);
+    pseudo_header->src_addr = src_addr;
+    pseudo_header->dst_addr = dst_addr;
+    pseudo_header->zero = 0;
+    pseudo_header->protocol = IPPROTO_UDP;
+    pseudo_header->length = change_order((u_short)(SIZE_UDP + length));
+    udp_header->src_port = src_port;
+    udp_header->dst_port = dst_port;
+    udp_header->length = pseudo_header->length;
+    udp_header->checksum = 0;
+    udp_header->checksum = calculate_checksum(datagram, total_len);
+    // An all-zero checksum means no checksum. See RFC768.
+    if(udp_header->checksum == 0){
+        udp_header->checksum = 0xffff;
+    }
+
+    int rc = network_layer->sendIPPacket(src_addr, dst_addr, IPPROTO_UDP,
+                                         datagram + SIZE_PSEUDO,
+                                         SIZE_UDP + length, DEFAULT_TTL, tos);
+    delete[] datagram;
+    releaseUDP(udp);
+    if(rc == -1){
+        errno = EHOSTUNREACH;
+        return -1;
+    }
+    return length;
+}
+
+/**
+ * @brief Receive a datagram on a UDP socket. The part of it longer than
+ * LENGTH is discarded.
+ *
+ * @note Only MSG_DONTWAIT of FLAGS is supported.
+ */
+ssize_t 
+TransportLayer::_recvfrom(int socket, void *buffer, size_t length, int flags,
+                          struct sockaddr *address, socklen_t *address_len)
+{
+    UDPSocket *udp = acquireUDP(socket);
+    if(udp == NULL){
+        return __real_recvfrom(socket, buffer, length, flags,
+                               address, address_len);
+    }
+
+    // Each post of the semaphore is a datagram in the queue, or a wakeup
+    // on close.
+    if(flags & MSG_DONTWAIT){
+        if(sem_trywait(&udp->semaphore) == -1){
+            releaseUDP(udp);
+            errno = EAGAIN;
+            return -1;
+        }
+    }
+    else{
+        bool received = false;
+        if(udp->busy_poll > 0){
+            // Receive the datagram in this thread rather than wait for the
+            // receiving thread to hand it over, for at most `busy_poll`.
+            struct in_addr src = {0};
+            if(udp->connected){
+                src = udp->dst_addr;
+            }
+            auto deadline = std::chrono::steady_clock::now() +
+                            std::chrono::microseconds(udp->busy_poll);
+            while(std::chrono::steady_clock::now() < deadline){
+                if(sem_trywait(&udp->semaphore) == 0){
+                    received = true;
+                    break;
+                }
+                network_layer->busyPoll(src);
+            }
+        }
+        if(!received){
+            while(sem_wait(&udp->semaphore) == -1){
+            }
+        }
+    }
+    if(udp->closed){
+        releaseUDP(udp);
+        errno = EBADF;
+        return -1;
+    }
+
+    udp->recv_mutex.lock();
+    UDPDatagram *datagram = udp->queue.front();
+    size_t len = std::min(length, (size_t)datagram->len);
+    memcpy(buffer, datagram->data.data(), len);
+    if(address != NULL){
+        struct sockaddr_in from;
+        memset(&from, 0, sizeof(from));
+        from.sin_family = AF_INET;
+        from.sin_addr = datagram->src_addr;
+        from.sin_port = datagram->src_port;
+        if(*address_len > sizeof(from)){
+            *address_len = sizeof(from);
+        }
+        memcpy(address, &from, *address_len);
+    }
+    udp->queue.pop();
+    udp->recv_mutex.unlock();
+    releaseUDP(udp);
+    return len;
+}
+
+/**
+ * @brief Callback function on receiving a UDP datagram. The datagram is
+ * queued on the socket bound to its destination port, or dropped if there
+ * is none or its queue is full.
+ *
+ * @param buf Pointer to the UDP datagram. The 12 bytes before it are
+ * overwritten by the pseudo header.
+ * @param len Length of the UDP datagram.
+ * @param src_addr Source address of the IP datagram.
+ * @param dst_addr Destination address of the IP datagram.
+ * @return `true` on success, `false` on error.
+ */
+bool 
+TransportLayer::udpCallBack(const u_char *buf, int len,
+                            struct in_addr src_addr, struct in_addr dst_addr)
+{
+    const UDPHeader *udp_header = (const UDPHeader *)buf;
+    if(len < SIZE_UDP){
+        std::cerr << "UDP datagram too short!" << std::endl;
+        return false;
+    }
+    int udp_len = (u_short)change_order(udp_header->length);
+    if((udp_len < SIZE_UDP) || (udp_len > len)){
+        std::cerr << "UDP length error!" << std::endl;
+        return false;
+    }
+
+    // Calculate checksum unless the sender didn't.
+    if(udp_header->checksum != 0){
+        PseudoHeader *pseudo_header = (PseudoHeader *)(buf - SIZE_PSEUDO);
+        pseudo_header->src_addr = src_addr;
+        pseudo_header->dst_addr = dst_addr;
+        pseudo_header->zero = 0;
+        pseudo_header->protocol = IPPROTO_UDP;
+        pseudo_header->length = udp_header->length;
+        u_short sum = calculate_checksum((const u_char *)pseudo_header,
+                                         SIZE_PSEUDO + udp_len);
+        if(sum != 0){
+            std::cerr << "UDP checksum error!" << std::endl;
+            return false;
+        }
+    }
+
+    udp_mutex.lock();
+    auto it = port2udp.find(udp_header->dst_port);
+    if(it == port2udp.end()){
+        udp_mutex.unlock();
+        return true;
+    }
+    UDPSocket *udp = it->second;
+    if((udp->src_addr.s_addr != INADDR_ANY) &&
+       (udp->src_addr.s_addr != dst_addr.s_addr))
+    {
+        udp_mutex.unlock();
+        return true;
+    }
+    // A connected socket only receives datagrams from its peer.
+    if(udp->connected && 
+       ((udp->dst_addr.s_addr != src_addr.s_addr) ||
+        (udp->dst_port != udp_header->src_port)))
+    {
+        udp_mutex.unlock();
+        return true;
+    }
+    if(udp->queue.push(buf + SIZE_UDP, udp_len - SIZE_UDP, src_addr,
+                       udp_header->src_port))
+    {
+        sem_post(&udp->semaphore);
+    }
+    else{
+        udp->drops++;
+    }
+    udp_mutex.unlock();
+    return true;
+}
@@ -0,0 +1,43 @@
+/**
+ * @file traceroute.cpp
+ * 
+ * @brief Probe the path to a host with ICMP echo requests and print the RTT 
+ * histogram of each hop.
+ * 
+ * Usage: traceroute <destination> [probes per hop]
+ */
+
+#include <ip/ip.h>
+#include <arpa/inet.h>
+#include <cstdlib>
+#include <iostream>
+
+int main(int argc, char *argv[])
+{
+    if(argc < 2){
+        std::cerr << "Usage: " << argv[0];
+        std::cerr << " <destination> [probes per hop]" << std::endl;
+        return 1;
+    }
+    struct in_addr dest;
+    if(inet_pton(AF_INET, argv[1], &dest) <= 0){
+        std::cerr << "Invalid destination: " << argv[1] << std::endl;
+        return 1;
+    }
+    int count = (argc > 2) ? atoi(argv[2]) : 3;
+
+    NetworkLayer network_layer;
+    // Wait for the routing table to converge.
+    std::this_thread::sleep_for(std::chrono::milliseconds(10000));
+
+    std::vector<HopStats> hops;
+    int n = network_layer.probe(dest, PROBE_MAX_HOPS, count, hops);
+    for(size_t i = 0; i < hops.size(); i++){
+        hops[i].print(i + 1);
+    }
+    if(n == -1){
+        std::cout << argv[1] << " not reached." << std::endl;
+        return 1;
+    }
+    return 0;
+}
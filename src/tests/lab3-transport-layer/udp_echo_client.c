@@ -0,0 +1,91 @@
+//
+// UDP counterpart of echo_client.c.
+//
+
+#include "unp.h"
+
+const char* message = "hello\n"
+"world\n\n\n"
+"Looooooooooooooooooooooooooooooooooooooooooooong\n"
+"what\na\nt\ne\nr\nr\ni\nb\nl\ne\n"
+"\n\n\n";
+
+#define MSG_LEN 15000
+// Keep each datagram within a single Ethernet frame.
+#define DGRAM_LEN 1024
+char message_buf[MSG_LEN];
+
+void populate_buf() {
+  int i;
+  int message_len = strlen(message);
+  memcpy(message_buf, message, message_len);
+  i = message_len;
+  while (i + 1 < MSG_LEN) {
+    message_buf[i] = 'a' + (i % 26);
+    i += 1;
+  }
+  message_buf[i] = '\n';
+}
+
+void dg_cli(FILE *fp, int sockfd, const struct sockaddr *servaddr,
+            socklen_t servlen) {
+  char sendline[DGRAM_LEN];
+  char recvline[DGRAM_LEN];
+  ssize_t len;
+  ssize_t n;
+  while (fgets(sendline, DGRAM_LEN, fp) != NULL) {
+    len = strlen(sendline);
+    if (sendto(sockfd, sendline, len, 0, servaddr, servlen) != len) {
+      printf("dg_cli: sendto error\n");
+      exit(1);
+    }
+
+    n = recvfrom(sockfd, recvline, DGRAM_LEN, 0, NULL, NULL);
+    if (n < 0) {
+      printf("dg_cli: recvfrom error\n");
+      exit(1);
+    }
+    if (n != len || memcmp(sendline, recvline, len) != 0) {
+      printf("dg_cli: echo mismatch\n");
+      exit(1);
+    }
+  }
+  // An empty datagram tells the server this round is over.
+  sendto(sockfd, sendline, 0, 0, servaddr, servlen);
+}
+
+void cli_client(const char* addr) {
+  int sockfd;
+  struct sockaddr_in servaddr;
+  FILE* fp;
+
+  sockfd = Socket(AF_INET, SOCK_DGRAM, 0);
+  bzero(&servaddr, sizeof(servaddr));
+  servaddr.sin_family = AF_INET;
+  servaddr.sin_port = htons(10086);
+  Inet_pton(AF_INET, addr, &servaddr.sin_addr);
+
+  populate_buf();
+
+  fp = fmemopen(message_buf, MSG_LEN, "r");
+  dg_cli(fp, sockfd, (struct sockaddr *) &servaddr, sizeof(servaddr));
+  fclose(fp);
+
+  close(sockfd);
+}
+
+int main(int argc, char *argv[]) {
+  int loop;
+
+  if (argc != 2) {
+    printf("usage: %s <IPaddress>\n", argv[0]);
+    return -1;
+  }
+
+  for (loop = 0; loop < 3; loop++) {
+    cli_client(argv[1]);
+    printf("loop #%d ok.\n", loop + 1);
+  }
+
+  return 0;
+}
@@ -0,0 +1,55 @@
+//
+// UDP counterpart of echo_server.c.
+//
+
+#include "unp.h"
+
+void dg_echo(int sockfd) {
+  ssize_t n;
+  char buf[MAXLINE];
+  struct sockaddr_in cliaddr;
+  socklen_t clilen;
+  size_t acc = 0;
+  for (;;) {
+    clilen = sizeof(cliaddr);
+    n = recvfrom(sockfd, buf, MAXLINE, 0, (struct sockaddr *) &cliaddr,
+                 &clilen);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    } else if (n < 0) {
+      printf("dg_echo: recvfrom error\n");
+      return;
+    }
+    // An empty datagram ends the current round.
+    if (n == 0) {
+      break;
+    }
+    if (sendto(sockfd, buf, n, 0, (struct sockaddr *) &cliaddr,
+               clilen) != n) {
+      printf("dg_echo: sendto error\n");
+    }
+    acc += n;
+    printf("%zu ", acc);
+    fflush(stdout);
+  }
+  printf("all: %zu\n", acc);
+}
+
+int main(int argc, char *argv[]) {
+  struct sockaddr_in servaddr;
+  int sockfd = Socket(AF_INET, SOCK_DGRAM, 0);
+  int loop;
+
+  bzero(&servaddr, sizeof(servaddr));
+  servaddr.sin_family = AF_INET;
+  servaddr.sin_addr.s_addr = htonl(INADDR_ANY);
+  servaddr.sin_port = htons(10086);
+
+  Bind(sockfd, (struct sockaddr *) &servaddr, sizeof(servaddr));
+
+  for (loop = 0; loop < 3; loop++) {
+    dg_echo(sockfd);
+  }
+  close(sockfd);
+  return 0;
+}